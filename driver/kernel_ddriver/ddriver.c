@@ -4,6 +4,8 @@
 #include <linux/fs.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h>
 #include "ddriver_ctl.h"
 /******************************************************************************
 * SECTION: Macro definitions
@@ -27,14 +29,14 @@
                         "filp_open/cpp-filp_open-function-examples.html>"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)             /* Default of disk_size */
+#define CONFIG_BLOCK_SZ (512)                         /* Default of block_size */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     (addr % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk.iounit_size) * disk.iounit_size)
 
 #define GET_HEAD_POS(disk)      (disk.head - disk.layout)
 #define FORWARD_HEAD(disk, dis) (disk.head += dis)
@@ -51,23 +53,31 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR(DRIVER_AUTHOR);	    
 MODULE_DESCRIPTION(DRIVER_DESC);	
 MODULE_VERSION(DRIVER_VERSION);	
+
+static unsigned long disk_size = CONFIG_DISK_SZ;
+module_param(disk_size, ulong, 0444);
+MODULE_PARM_DESC(disk_size, "Disk size in bytes, multiple of block_size");
+static int block_size = CONFIG_BLOCK_SZ;
+module_param(block_size, int, 0444);
+MODULE_PARM_DESC(block_size, "IO unit size in bytes, power of 2 and >= 512");
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
 struct ddriver
 {
-    char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
+    char *layout;                                     /* Disk Layout, vmalloc-ed at load */
     char *head;                                       /* Disk Head */
     int  read_cnt;
     int  write_cnt;
     int  seek_cnt;
     int  major_num;
     int  open_count;
-    int  layout_size;
+    long layout_size;
     int  iounit_size;
 };
 
 static struct ddriver disk = {
+    .layout      = NULL,
     .head        = NULL,
     .read_cnt    = 0,
     .write_cnt   = 0,
@@ -81,12 +91,12 @@ static struct ddriver disk = {
 * SECTION: Helper Functions
 *******************************************************************************/
 int check_valid(size_t size){
-    if (GET_HEAD_POS(disk) >=  CONFIG_DISK_SZ) {
+    if (GET_HEAD_POS(disk) < 0 || GET_HEAD_POS(disk) >= disk.layout_size) {
         kernel_alert("disk head reach the end");
         return -EINVAL;
     }
-    if (size != CONFIG_BLOCK_SZ){
-        kernel_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size != disk.iounit_size){
+        kernel_alert("io size %ld should align to %d", size, disk.iounit_size);
         return -EIO;
     }
     return 0;
@@ -119,7 +129,7 @@ static struct file_operations file_ops = {
  * 
  * @param file          Ignored
  * @param user_buffer   User space buffer
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
+ * @param size          Must equal to Blocksize @block_size
  * @param offset        Ignored
  * @return ssize_t      Bytes have been read 
  */
@@ -130,18 +140,18 @@ device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
     int res = check_valid(size);
     if(res < 0)
         return res;
-    if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
+    if (copy_to_user(user_buffer, disk.head, disk.iounit_size))
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
+    FORWARD_HEAD(disk, disk.iounit_size);
     INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return disk.iounit_size;
 }
 /**
  * @brief Disk Write
  * 
  * @param file          Ignored
  * @param user_buffer   User space buffer, copy content from
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
+ * @param size          Must equal to Blocksize @block_size
  * @param offset        Ignored
  * @return ssize_t      Bytes have been written
  */
@@ -153,17 +163,17 @@ device_write(struct file *file, const char *user_buffer, size_t size, loff_t *of
     if(res < 0)
         return res;
 
-    if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
+    if (copy_from_user(disk.head, user_buffer, disk.iounit_size))
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
+    FORWARD_HEAD(disk, disk.iounit_size);
     INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return disk.iounit_size;
 }
 /**
  * @brief Disk Seek
  * 
  * @param file          Ignored
- * @param offset        Aligned to @CONFIG_BLOCK_SZ
+ * @param offset        Aligned to @block_size
  * @param whence        SEEK_CUR, SEEK_SET
  * @return loff_t       cur pos
  */
@@ -172,7 +182,7 @@ device_seek(struct file *file, loff_t offset, int whence) {
     IGNORE_ARG(file);
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
     switch (whence)
@@ -201,11 +211,21 @@ static long
 device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
     IGNORE_ARG(file);
     int ret;
+    int size;
+    long long size64;
     struct ddriver_state state;
     switch (cmd)
     {
-    case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        ret = copy_to_user((int __user *)arg, &disk.layout_size, sizeof(int));
+    case IOC_REQ_DEVICE_SIZE:                         /* Device Size, clamped to INT_MAX */
+        size = disk.layout_size > INT_MAX ? INT_MAX / disk.iounit_size * disk.iounit_size
+                                          : (int)disk.layout_size;
+        ret = copy_to_user((int __user *)arg, &size, sizeof(int));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size (64 bit) */
+        size64 = disk.layout_size;
+        ret = copy_to_user((long long __user *)arg, &size64, sizeof(long long));
         if (ret) 
             return -EFAULT;
         break;
@@ -276,16 +296,36 @@ device_release(struct inode *inode, struct file *file) {
 static int __init 
 ddriver_init(void)
 {
-    int major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
+    int major_num;
+
+    if (block_size < 512 || (block_size & (block_size - 1)) != 0) {
+        kernel_alert("block_size %d should be a power of 2 and >= 512", block_size);
+        return -EINVAL;
+    }
+    if (disk_size == 0 || disk_size % block_size != 0) {
+        kernel_alert("disk_size %lu should be a multiple of block_size %d", disk_size, block_size);
+        return -EINVAL;
+    }
+    disk.layout = vzalloc(disk_size);                 /* Zeroed disk layout */
+    if (disk.layout == NULL) {
+        kernel_alert("Can't allocate %lu bytes of disk", disk_size);
+        return -ENOMEM;
+    }
+    disk.layout_size = disk_size;
+    disk.iounit_size = block_size;
+
+    major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
                                                       /* Register an device */
     if (major_num < 0) {                              /* Register fail */
         kernel_alert("Can't register device, ret %d", major_num);
+        vfree(disk.layout);
+        disk.layout = NULL;
         return major_num;
     } 
     else {                                            /* Register success */                                                  
-        kernel_info("module loaded with device major number %d", major_num);
+        kernel_info("module loaded with device major number %d, disk %lu bytes, block %d bytes",
+                    major_num, disk_size, block_size);
         disk.major_num = major_num;
-        memset(disk.layout, 0, CONFIG_DISK_SZ);
         return 0;
     }
     return 0;
@@ -299,6 +339,8 @@ ddriver_exit(void)
     if(major_num != 0){
         unregister_chrdev(major_num, DEVICE_NAME);
     }
+    vfree(disk.layout);
+    disk.layout = NULL;
 }
 
 module_init(ddriver_init);
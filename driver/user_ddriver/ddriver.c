@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
@@ -10,6 +11,11 @@
 #include "errno.h"
 #include <pwd.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <math.h>
 
 extern int errno;
 
@@ -22,6 +28,21 @@ extern int errno;
 *******************************************************************************/   
 #define DEVICE_NAME   "ddriver"
 #define DEVICE_LOG    "ddriver_log"
+#define DEVICE_MMAP_ENV "DDRIVER_MMAP"               /* 非空且不为"0"时以mmap方式访问磁盘镜像 */
+#define DEVICE_DISK_SZ_ENV   "DDRIVER_DISK_SZ"       /* 磁盘大小，可带 K/M/G 后缀 */
+#define DEVICE_SECTOR_SZ_ENV "DDRIVER_SECTOR_SZ"     /* 扇区大小，512的2的幂倍 */
+#define DEVICE_TRACKS_ENV    "DDRIVER_TRACKS"        /* 磁道数 */
+#define DEVICE_PROFILE_ENV   "DDRIVER_PROFILE"       /* 设备模型名，见 profiles */
+#define DEVICE_READ_LAT_ENV  "DDRIVER_READ_LAT"      /* 随机读延迟 (us) */
+#define DEVICE_WRITE_LAT_ENV "DDRIVER_WRITE_LAT"     /* 随机写延迟 (us) */
+#define DEVICE_SEEK_LAT_ENV  "DDRIVER_SEEK_LAT"      /* 转一圈的延迟 (us) */
+#define DEVICE_PARALLEL_ENV  "DDRIVER_PARALLEL"      /* 设备内部并行度 */
+#define DEVICE_TAIL_ENV      "DDRIVER_TAIL"          /* 长尾分布：none / exp / pareto */
+#define DEVICE_TAIL_PPM_ENV  "DDRIVER_TAIL_PPM"      /* 每百万个请求中的长尾个数 */
+#define DEVICE_TAIL_US_ENV   "DDRIVER_TAIL_US"       /* 长尾附加延迟 (us) */
+#define DEVICE_VCLOCK_ENV    "DDRIVER_VCLOCK"        /* 非空且不为"0"时只累计模拟时间，不真正等待 */
+#define DEVICE_TRACE_ENV     "DDRIVER_TRACE"         /* 非空时把每个请求记录到这个环形trace文件 */
+#define DEVICE_TRACE_RECORDS_ENV "DDRIVER_TRACE_RECORDS" /* trace文件最多保留的记录数，可带 K/M 后缀 */
 
 #define user_info(fmt, ...)\
 	do {\
@@ -44,52 +65,119 @@ extern int errno;
 #define DRIVER_DESC     "A Fake disk driver in user space"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)             /* 默认值，实际大小见 disk.layout_size */
+#define CONFIG_BLOCK_SZ (512)                         /* 默认值，实际大小见 disk.iounit_size */
+#define CONFIG_TRACKS   (100)
+#define CONFIG_PROFILE  "classic"                     /* 默认设备模型 */
+#define CONFIG_PARETO_ALPHA (1.5)                     /* pareto长尾的形状参数 */
+#define CONFIG_TAIL_CAP (100)                         /* 长尾附加延迟最多为 tail_us 的倍数 */
+#define CONFIG_TRACE_RECORDS (1024 * 1024)            /* trace默认保留的记录数，约24MB */
+#define CONFIG_WORKERS  (8)                          /* 异步请求的服务线程数 */
+#define CONFIG_DEADLINE_MS (500)                     /* deadline调度下请求的最长等待时间 */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     (addr % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk.iounit_size) * disk.iounit_size)
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
-
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
+#define INC_SEEKCNT(disk)       (__atomic_fetch_add(&disk.seek_cnt, 1, __ATOMIC_RELAXED))
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
 struct ddriver
 {
     int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  read_lat;
-    int  write_lat;
-    int  seek_lat;
+    unsigned long long read_cnt;
+    unsigned long long write_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long read_lat_hist[DDRIVER_LAT_BUCKETS];  /* 第i格：延迟在 [2^i, 2^(i+1)) us */
+    unsigned long long write_lat_hist[DDRIVER_LAT_BUCKETS];
+    unsigned long long read_heat[DDRIVER_HEAT_REGIONS];     /* 按请求起始偏移所在区域计数 */
+    unsigned long long write_heat[DDRIVER_HEAT_REGIONS];
+    struct ddriver_profile prof;                     /* 设备模型，各项延迟都是 us */
     int  track_num;
     int  major_num;
-    int  layout_size;
+    off_t layout_size;
     int  iounit_size;
+    off_t head;                                      /* 磁头位置，仅 pread/pwrite 使用 */
+    int  queue_depth;                                /* 同时服务的请求数上限 */
+    int  inflight;                                   /* 正在服务的请求数 */
+    long seek_dist;                                  /* 累计寻道距离 (字节) */
+    char *map;                                       /* mmap模式下映射的磁盘镜像，NULL时用read/write */
+    int  virtual_clock;                              /* 非0时延迟只记入 sim_us，不调用 usleep */
+    struct ddriver_trace_hdr *trace;                 /* 映射的trace文件，NULL时不记录 */
+    long long trace_start;                           /* trace开始的时间 (us) */
+    long long sim_us;                                /* 累计模拟设备时间 (us) */
+    int  seek_pending;                               /* ddriver_seek 移动了磁头，下一次读写不是顺序的 */
 };
 /******************************************************************************
 * SECTION: Global Variable
 *******************************************************************************/
-/* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
+/* 
+ * 设备模型，各项延迟单位为 us
+ * classic : 原来的模型，读2ms、写1ms、转一圈4ms，不区分顺序与随机
+ * hdd     : 7200rpm SATA 硬盘，寻道时间随距离按平方根增长
+ * sata_ssd: SATA SSD，NCQ下少量并行，GC造成的长尾较重
+ * nvme    : NVMe SSD，深队列并行，写入有缓存
+ * reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics
+ */
+static const struct ddriver_profile profiles[] = {
+    /* name        read  seqr  write seqw  seek_min seek_max rotate  MB/s  par  tail               ppm   tail_us */
+    { "classic",   2000, 2000, 1000, 1000, 0,       0,       4000,   0,    1,   DDRIVER_TAIL_NONE,   0,    0     },
+    { "hdd",       200,  50,   200,  50,   600,     15000,   8333,   160,  1,   DDRIVER_TAIL_EXP,    1000, 10000 },
+    { "sata_ssd",  100,  40,   70,   30,   0,       0,       0,      530,  4,   DDRIVER_TAIL_PARETO, 2000, 1000  },
+    { "nvme",      80,   20,   20,   10,   0,       0,       0,      3200, 32,  DDRIVER_TAIL_PARETO, 500,  300   },
+};
+
 struct ddriver disk = {
     .read_cnt    = 0,
     .write_cnt   = 0,
     .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
     .major_num   = 0,
-    .track_num   = 100,
+    .track_num   = CONFIG_TRACKS,
     .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .head        = 0,
+    .queue_depth = 1,       /* 单磁头，请求逐个服务 */
+    .inflight    = 0,
+    .seek_dist   = 0,
+    .map         = NULL,
+    .virtual_clock = 0,
+    .sim_us      = 0,
+    .seek_pending = 0
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+
+/* 异步请求：服务线程按调度策略从提交队列取出执行，完成后进入完成队列等待 ddriver_poll */
+struct ddriver_aio
+{
+    struct ddriver_req *sq_head;
+    struct ddriver_req *sq_tail;
+    struct ddriver_req *cq_head;
+    struct ddriver_req *cq_tail;
+    int                 cq_cnt;
+    int                 sched;                       /* DDRIVER_SCHED_* */
+    off_t               scan_pos;                    /* 电梯调度上次派发的位置 */
+    int                 scan_up;                     /* 电梯当前方向 */
+    int                 started;
+    int                 stopping;
+    pthread_t           workers[CONFIG_WORKERS];
+    pthread_mutex_t     lock;
+    pthread_cond_t      sq_cond;
+    pthread_cond_t      cq_cond;
+};
+
+static struct ddriver_aio aio = {
+    .sched   = DDRIVER_SCHED_FIFO,
+    .scan_up = 1,
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
+    .sq_cond = PTHREAD_COND_INITIALIZER,
+    .cq_cond = PTHREAD_COND_INITIALIZER
 };
 
 FILE *debugf = NULL;
@@ -97,70 +185,839 @@ FILE *debugf = NULL;
 * SECTION: Helper Functions
 *******************************************************************************/
 int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size != disk.iounit_size){
+        user_alert("io size %ld should align to %d", size, disk.iounit_size);
         return -EIO;
     }
     return 0;
 }
 
-int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
-    int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
-    
-    if (distance == 0) {
+ssize_t check_valid_vec(const struct iovec *iov, int iovcnt) {
+    ssize_t total = 0;
+    int i;
+    if (iovcnt <= 0 || iovcnt > UIO_MAXIOV) {
+        user_alert("iovcnt %d out of range", iovcnt);
+        return -EINVAL;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0 || !IS_ADDR_ALIGN(iov[i].iov_len)) {
+            user_alert("iov[%d] size %ld should align to %d", i, iov[i].iov_len, disk.iounit_size);
+            return -EIO;
+        }
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+/**
+ * @brief 模拟一段设备耗时：请求等待 lat_us，模拟时钟记入 busy_us，虚拟时钟模式下不真正等待
+ * 
+ * 模拟时钟是设备忙的时间，多个请求在设备内部并行时分摊，见 emulate_io
+ */
+void emulate_delay(long lat_us, long busy_us) {
+    if (busy_us > 0) {
+        __atomic_fetch_add(&disk.sim_us, busy_us, __ATOMIC_RELAXED);
+    }
+    if (lat_us > 0 && !__atomic_load_n(&disk.virtual_clock, __ATOMIC_RELAXED)) {
+        usleep(lat_us);
+    }
+}
+
+/**
+ * @brief 每个线程独立的 xorshift64* 随机数，返回 (0, 1]
+ */
+static double rand_unit(void) {
+    static unsigned long long seed = 0;
+    static __thread unsigned long long state = 0;
+
+    if (state == 0) {
+        state = __atomic_add_fetch(&seed, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+    }
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return ((state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0) + 0x1p-53;
+}
+
+/**
+ * @brief 按 tail_ppm 的概率抽取一个长尾附加延迟
+ */
+static long tail_time(const struct ddriver_profile *prof) {
+    double extra;
+
+    if (prof->tail_dist == DDRIVER_TAIL_NONE || prof->tail_ppm <= 0 ||
+        rand_unit() * 1000000 > prof->tail_ppm) {
+        return 0;
+    }
+    if (prof->tail_dist == DDRIVER_TAIL_EXP) {
+        extra = -log(rand_unit()) * prof->tail_us;
+    }
+    else {
+        extra = prof->tail_us / pow(rand_unit(), 1 / CONFIG_PARETO_ALPHA);
+    }
+    return extra > (double)prof->tail_us * CONFIG_TAIL_CAP ? (long)prof->tail_us * CONFIG_TAIL_CAP
+                                                           : (long)extra;
+}
+
+/**
+ * @brief 机械磁头从 start 移到 end 的时间：寻道 + 旋转
+ * 
+ * 跨磁道时寻道时间在 seek_min_us 到 seek_max_us 之间随距离按平方根增长；
+ * 旋转延迟按磁道内的偏移线性计算。没有机械部件的设备返回0
+ */
+long position_time(off_t start, off_t end) {
+    const struct ddriver_profile *prof = &disk.prof;
+    long bytes_per_track = disk.layout_size / disk.track_num;
+    long distance = labs(end - start);
+    long tracks = distance / bytes_per_track;
+    long us = 0;
+
+    if (tracks > 0 && prof->seek_max_us > 0) {
+        us += prof->seek_min_us + (long)((prof->seek_max_us - prof->seek_min_us) *
+                                         sqrt((double)tracks / disk.track_num));
+    }
+    if (prof->rotate_us > 0) {
+        us += distance % bytes_per_track * prof->rotate_us / bytes_per_track;
+    }
+    return us;
+}
+
+/**
+ * @brief 模拟一次读写，调用者已占用请求队列的位置
+ * 
+ * 服务时间 = 定位时间 (pos_us) + 顺序/随机的基本延迟 + 传输时间 + 长尾。
+ * 在途请求超过设备并行度时要在设备内排队，请求的延迟按比例变长；
+ * 模拟时钟记入的是服务时间除以实际并行的请求数，即这个请求占用设备的时间
+ * 
+ * @return long 请求的延迟 (us)
+ */
+long emulate_io(long pos_us, ssize_t size, int is_write, int sequential) {
+    const struct ddriver_profile *prof = &disk.prof;
+    int inflight = __atomic_load_n(&disk.inflight, __ATOMIC_RELAXED);
+    int parallel = prof->parallel > 0 ? prof->parallel : 1;
+    long svc;
+
+    if (is_write) {
+        svc = sequential ? prof->seq_write_us : prof->write_us;
+    }
+    else {
+        svc = sequential ? prof->seq_read_us : prof->read_us;
+    }
+    svc += pos_us + tail_time(prof);
+    if (prof->bandwidth_mb > 0) {
+        svc += size / prof->bandwidth_mb;            /* 1 MB/s 即 1 B/us */
+    }
+    if (inflight < 1) {
+        inflight = 1;
+    }
+    if (inflight > parallel) {
+        emulate_delay(svc * inflight / parallel, svc / parallel);
+        return svc * inflight / parallel;
+    }
+    emulate_delay(svc, svc / inflight);
+    return svc;
+}
+
+/**
+ * @brief 区域大小：磁盘均分为 DDRIVER_HEAT_REGIONS 份，向上对齐到扇区
+ */
+static long heat_region_sz(void) {
+    long sz = (disk.layout_size + DDRIVER_HEAT_REGIONS - 1) / DDRIVER_HEAT_REGIONS;
+
+    return (sz + disk.iounit_size - 1) / disk.iounit_size * disk.iounit_size;
+}
+
+/**
+ * @brief 记录一次完成的读写：次数、字节数、延迟直方图和区域热度
+ */
+void account_io(off_t offset, ssize_t size, int is_write, long lat_us) {
+    int bucket = lat_us > 1 ? 63 - __builtin_clzll(lat_us) : 0;
+    long region = offset / heat_region_sz();
+
+    if (bucket >= DDRIVER_LAT_BUCKETS) {
+        bucket = DDRIVER_LAT_BUCKETS - 1;
+    }
+    if (region >= DDRIVER_HEAT_REGIONS) {
+        region = DDRIVER_HEAT_REGIONS - 1;
+    }
+    if (is_write) {
+        __atomic_fetch_add(&disk.write_cnt, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&disk.write_bytes, size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&disk.write_lat_hist[bucket], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&disk.write_heat[region], 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_fetch_add(&disk.read_cnt, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&disk.read_bytes, size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&disk.read_lat_hist[bucket], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&disk.read_heat[region], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief 请求入队，队列中已有 queue_depth 个请求在服务时等待
+ * 
+ * 模拟延迟在队列内计时，queue_depth 为1时多个线程的请求依次完成，
+ * 调大后可以有多个请求同时在途
+ */
+void queue_enter(void) {
+    pthread_mutex_lock(&queue_lock);
+    while (disk.inflight >= disk.queue_depth) {
+        pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+    __atomic_add_fetch(&disk.inflight, 1, __ATOMIC_RELAXED);   /* emulate_io 在锁外读取 */
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void queue_leave(void) {
+    pthread_mutex_lock(&queue_lock);
+    __atomic_sub_fetch(&disk.inflight, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/**
+ * @brief 定位请求的寻道模拟：磁头从上一次请求的结束位置移到 offset
+ * 
+ * 磁头位置原子交换，不依赖fd的文件偏移，多个线程可以共用同一个fd；
+ * 与上一次请求首尾相接时不算一次SEEK
+ * 
+ * @return long 定位时间 (us)，顺序请求返回-1
+ */
+long emulate_seek_to(int fd, off_t offset, ssize_t size) {
+    off_t prev = __atomic_exchange_n(&disk.head, offset + size, __ATOMIC_RELAXED);
+
+    if (prev == offset) {
+        return -1;
+    }
+    INC_SEEKCNT(disk);
+    __atomic_fetch_add(&disk.seek_dist, labs(offset - prev), __ATOMIC_RELAXED);
+    return position_time(prev, offset);
+}
+
+int check_offset(off_t offset) {
+    if (offset < 0 || !IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                      offset, disk.iounit_size);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief 在磁盘镜像与 iov 之间搬运数据，不计延迟和次数
+ * 
+ * mmap模式下直接 memcpy，否则用 preadv / pwritev
+ * 
+ * @return int 搬运的字节数，小于0失败
+ */
+int dev_xfer(int fd, const struct iovec *iov, int iovcnt, off_t offset, ssize_t size, int is_write) {
+    int i;
+
+    /* 两种后端都要检查，否则 pwritev 会把镜像文件撑大 */
+    if (offset + size > disk.layout_size) {
+        user_alert("io [%ld, %ld) out of disk", offset, offset + size);
+        return -EIO;
+    }
+    if (disk.map == NULL) {
+        if ((is_write ? pwritev(fd, iov, iovcnt, offset) : preadv(fd, iov, iovcnt, offset)) != size) {
+            user_panic("%s error: %s", is_write ? "pwritev" : "preadv", strerror(errno));
+            return -EIO;
+        }
+        return size;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        if (is_write) {
+            memcpy(disk.map + offset, iov[i].iov_base, iov[i].iov_len);
+        }
+        else {
+            memcpy(iov[i].iov_base, disk.map + offset, iov[i].iov_len);
+        }
+        offset += iov[i].iov_len;
+    }
+    return size;
+}
+
+/**
+ * @brief 从fd当前的文件偏移处搬运数据并把偏移后移，供 ddriver_seek 之后的读写使用
+ */
+int dev_xfer_cur(int fd, const struct iovec *iov, int iovcnt, ssize_t size, int is_write) {
+    off_t cur;
+    int ret;
+
+    cur = lseek(fd, 0, SEEK_CUR);
+    ret = dev_xfer(fd, iov, iovcnt, cur, size, is_write);
+    if (ret > 0) {
+        lseek(fd, cur + ret, SEEK_SET);
+    }
+    return ret;
+}
+
+/**
+ * @brief 丢弃 [offset, offset + len) 的内容，之后读出全0
+ * 
+ * 在镜像文件上打洞，归还宿主机的磁盘空间；映射中的页随之清零。
+ * 宿主文件系统不支持打洞时退回写0
+ * 
+ * @return int 0成功，小于0失败
+ */
+int dev_discard(int fd, off_t offset, off_t len) {
+    char buf[4096] = {'\0'};
+    ssize_t n;
+
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0) {
+        return 0;
+    }
+    if (errno != EOPNOTSUPP) {
+        n = -errno;
+        user_alert("discard [%ld, %ld) error: %s", offset, offset + len, strerror(-n));
+        return n;
+    }
+    if (disk.map != NULL) {
+        memset(disk.map + offset, 0, len);
         return 0;
     }
+    while (len > 0) {
+        n = pwrite(fd, buf, len < (off_t)sizeof(buf) ? len : (off_t)sizeof(buf), offset);
+        if (n <= 0) {
+            user_panic("pwrite error: %s", strerror(errno));
+            return -EIO;
+        }
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief 执行一个已检查过的定位读写，调用者已占用请求队列的位置
+ * 
+ * @return int 读写的字节数，小于0失败
+ */
+int dev_rw(int fd, const struct iovec *iov, int iovcnt, off_t offset, ssize_t size, int is_write) {
+    int ret;
+    long pos_us, lat_us;
+
+    pos_us = emulate_seek_to(fd, offset, size);
+    lat_us = emulate_io(pos_us < 0 ? 0 : pos_us, size, is_write, pos_us < 0);
+    ret = dev_xfer(fd, iov, iovcnt, offset, size, is_write);
+    if (ret < 0) {
+        return ret;
+    }
+    account_io(offset, size, is_write, lat_us);
+    return ret;
+}
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 创建环形trace文件：ddriver_trace_hdr 之后是 records 条 ddriver_trace_rec
+ * 
+ * 文件以 MAP_SHARED 映射，记录直接写入映射，进程异常退出时已写入的记录也不会丢
+ */
+int trace_open(const char *path, long records) {
+    size_t len = sizeof(struct ddriver_trace_hdr) + records * sizeof(struct ddriver_trace_rec);
+    struct ddriver_trace_hdr *hdr;
+    int fd;
+
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (ftruncate(fd, len) < 0) {
+        close(fd);
+        return -errno;
+    }
+    hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        return -errno;
+    }
+    memcpy(hdr->magic, DDRIVER_TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version = DDRIVER_TRACE_VERSION;
+    hdr->rec_sz = sizeof(struct ddriver_trace_rec);
+    hdr->capacity = records;
+    hdr->next = 0;
+    hdr->disk_sz = disk.layout_size;
+    hdr->sector_sz = disk.iounit_size;
+    disk.trace_start = now_us();
+    disk.trace = hdr;
     return 0;
 }
+
+/**
+ * @brief 追加一条trace记录，写满后覆盖最旧的记录，可多线程并发调用
+ */
+void trace_io(int op, off_t offset, ssize_t size, int flags) {
+    struct ddriver_trace_hdr *hdr = disk.trace;
+    struct ddriver_trace_rec *rec;
+    unsigned long long idx;
+
+    if (hdr == NULL) {
+        return;
+    }
+    idx = __atomic_fetch_add(&hdr->next, 1, __ATOMIC_RELAXED);
+    rec = (struct ddriver_trace_rec *)(hdr + 1) + idx % hdr->capacity;
+    rec->ts_us = now_us() - disk.trace_start;
+    rec->offset = offset;
+    rec->len = size;
+    rec->op = op;
+    rec->flags = flags;
+}
+
+void trace_close(void) {
+    struct ddriver_trace_hdr *hdr = disk.trace;
+    size_t len;
+
+    if (hdr == NULL) {
+        return;
+    }
+    len = sizeof(struct ddriver_trace_hdr) + hdr->capacity * sizeof(struct ddriver_trace_rec);
+    disk.trace = NULL;
+    msync(hdr, len, MS_SYNC);
+    munmap(hdr, len);
+}
+
+/**
+ * @brief 电梯 (LOOK) 调度：沿当前方向找离上次派发位置最近的请求，
+ *        这个方向上没有请求时掉头
+ * 
+ * @return struct ddriver_req** 指向选中请求的链接指针
+ */
+struct ddriver_req **aio_scan(void) {
+    struct ddriver_req **cursor, **pick;
+    off_t dist, best;
+    int turn;
+
+    for (turn = 0; turn < 2; turn++) {
+        pick = NULL;
+        best = 0;
+        for (cursor = &aio.sq_head; *cursor; cursor = &(*cursor)->next) {
+            dist = aio.scan_up ? (*cursor)->offset - aio.scan_pos
+                               : aio.scan_pos - (*cursor)->offset;
+            if (dist >= 0 && (pick == NULL || dist < best)) {
+                pick = cursor;
+                best = dist;
+            }
+        }
+        if (pick) {
+            return pick;
+        }
+        aio.scan_up = !aio.scan_up;
+    }
+    return &aio.sq_head;
+}
+
+/**
+ * @brief 按调度策略从提交队列中取出下一个请求，调用者持有 aio.lock
+ * 
+ * FIFO 按提交顺序；SCAN 按电梯顺序；DEADLINE 平时按电梯顺序，
+ * 队首（最早提交的）请求等待超过 CONFIG_DEADLINE_MS 时优先派发它
+ */
+struct ddriver_req *aio_pick(void) {
+    struct ddriver_req **pick = &aio.sq_head;
+    struct ddriver_req *req, *prev;
+
+    if (aio.sq_head == NULL) {
+        return NULL;
+    }
+    if (aio.sched == DDRIVER_SCHED_SCAN ||
+        (aio.sched == DDRIVER_SCHED_DEADLINE &&
+         now_ms() - aio.sq_head->stamp < CONFIG_DEADLINE_MS)) {
+        pick = aio_scan();
+    }
+    req = *pick;
+    *pick = req->next;
+    if (aio.sq_tail == req) {
+        /* 取走的是队尾，找到它前面的请求作为新队尾 */
+        prev = aio.sq_head;
+        while (prev && prev->next) {
+            prev = prev->next;
+        }
+        aio.sq_tail = prev;
+    }
+    req->next = NULL;
+    aio.scan_pos = req->offset;
+    return req;
+}
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
- * @brief 打开驱动
+ * @brief 服务线程：取出提交的请求，同步执行后交给回调或放入完成队列
+ */
+void *aio_worker(void *arg) {
+    struct ddriver_req *req;
+    IGNORE_ARG(arg);
+
+    pthread_mutex_lock(&aio.lock);
+    while (1) {
+        while (aio.sq_head == NULL && !aio.stopping) {
+            pthread_cond_wait(&aio.sq_cond, &aio.lock);
+        }
+        if (aio.sq_head == NULL) {
+            break;
+        }
+        pthread_mutex_unlock(&aio.lock);
+
+        /* 先占到设备队列的位置再挑请求，等待期间提交的请求也参与调度 */
+        queue_enter();
+        pthread_mutex_lock(&aio.lock);
+        req = aio_pick();
+        pthread_mutex_unlock(&aio.lock);
+        if (req == NULL) {
+            queue_leave();
+            pthread_mutex_lock(&aio.lock);
+            continue;
+        }
+        req->res = dev_rw(req->fd, req->iov, req->iovcnt, req->offset,
+                          check_valid_vec(req->iov, req->iovcnt),
+                          req->op == DDRIVER_REQ_WRITE);
+        queue_leave();
+
+        if (req->done) {
+            req->done(req);
+            pthread_mutex_lock(&aio.lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&aio.lock);
+        if (aio.cq_tail) {
+            aio.cq_tail->next = req;
+        }
+        else {
+            aio.cq_head = req;
+        }
+        aio.cq_tail = req;
+        aio.cq_cnt++;
+        pthread_cond_broadcast(&aio.cq_cond);
+    }
+    pthread_mutex_unlock(&aio.lock);
+    return NULL;
+}
+
+/**
+ * @brief 第一次提交时启动服务线程，调用者持有 aio.lock
+ */
+int aio_start(void) {
+    int i, ret;
+
+    if (aio.started) {
+        return 0;
+    }
+    aio.stopping = 0;
+    for (i = 0; i < CONFIG_WORKERS; i++) {
+        ret = pthread_create(&aio.workers[i], NULL, aio_worker, NULL);
+        if (ret != 0) {
+            user_panic("can't start aio worker: %s", strerror(ret));
+            break;
+        }
+    }
+    aio.started = i;
+    return i > 0 ? 0 : -EAGAIN;
+}
+
+/**
+ * @brief 通知服务线程退出并等待，未执行的请求会先执行完
+ */
+void aio_stop(void) {
+    int i, started;
+
+    pthread_mutex_lock(&aio.lock);
+    started = aio.started;
+    aio.stopping = 1;
+    pthread_cond_broadcast(&aio.sq_cond);
+    pthread_mutex_unlock(&aio.lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(aio.workers[i], NULL);
+    }
+    aio.started = 0;
+}
+/**
+ * @brief 解析带 K/M/G 后缀的非负数，非法时返回-1
+ */
+static long parse_size(const char *str) {
+    char *end;
+    long val = strtol(str, &end, 0);
+
+    if (end == str || val < 0) {
+        return -1;
+    }
+    switch (*end) {
+    case 'g': case 'G': val <<= 10; /* fall through */
+    case 'm': case 'M': val <<= 10; /* fall through */
+    case 'k': case 'K': val <<= 10; end++; break;
+    case '\0': break;
+    default: return -1;
+    }
+    return *end == '\0' ? val : -1;
+}
+/**
+ * @brief 环境变量存在且合法时覆盖 *val，此时日志还没有打开，只输出到终端
+ */
+static void env_long(const char *name, long *val) {
+    char *str = getenv(name);
+    long parsed;
+
+    if (str == NULL || str[0] == '\0') {
+        return;
+    }
+    parsed = parse_size(str);
+    if (parsed < 0) {
+        user_panic("ignore invalid %s=%s", name, str);
+        return;
+    }
+    *val = parsed;
+}
+static void env_int(const char *name, int *val) {
+    long parsed = *val;
+
+    env_long(name, &parsed);
+    if (parsed > INT_MAX) {
+        user_panic("ignore invalid %s=%ld", name, parsed);
+        return;
+    }
+    *val = (int)parsed;
+}
+static int env_flag(const char *name) {
+    char *str = getenv(name);
+
+    return str != NULL && str[0] != '\0' && strcmp(str, "0") != 0;
+}
+/**
+ * @brief 按名字查找内置设备模型
  * 
+ * @param name classic / hdd / sata_ssd / nvme
+ * @param prof 找到时复制到这里，调用者可以再调整其中的各项
+ * @return int 0成功，-EINVAL没有这个模型
+ */
+int ddriver_find_profile(const char *name, struct ddriver_profile *prof) {
+    size_t i;
+
+    for (i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            *prof = profiles[i];
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+/**
+ * @brief 用环境变量覆盖设备模型，随机读写延迟改变时顺序读写延迟按同样比例缩放
+ */
+static void env_profile(struct ddriver_profile *prof) {
+    char *str;
+    int lat;
+
+    str = getenv(DEVICE_PROFILE_ENV);
+    if (str != NULL && str[0] != '\0' && ddriver_find_profile(str, prof) < 0) {
+        user_panic("ignore unknown %s=%s", DEVICE_PROFILE_ENV, str);
+    }
+    lat = prof->read_us;
+    env_int(DEVICE_READ_LAT_ENV, &prof->read_us);
+    if (lat > 0 && lat != prof->read_us) {
+        prof->seq_read_us = (long)prof->seq_read_us * prof->read_us / lat;
+    }
+    lat = prof->write_us;
+    env_int(DEVICE_WRITE_LAT_ENV, &prof->write_us);
+    if (lat > 0 && lat != prof->write_us) {
+        prof->seq_write_us = (long)prof->seq_write_us * prof->write_us / lat;
+    }
+    env_int(DEVICE_SEEK_LAT_ENV, &prof->rotate_us);
+    env_int(DEVICE_PARALLEL_ENV, &prof->parallel);
+    str = getenv(DEVICE_TAIL_ENV);
+    if (str != NULL && str[0] != '\0') {
+        if (strcmp(str, "none") == 0) {
+            prof->tail_dist = DDRIVER_TAIL_NONE;
+        }
+        else if (strcmp(str, "exp") == 0) {
+            prof->tail_dist = DDRIVER_TAIL_EXP;
+        }
+        else if (strcmp(str, "pareto") == 0) {
+            prof->tail_dist = DDRIVER_TAIL_PARETO;
+        }
+        else {
+            user_panic("ignore unknown %s=%s", DEVICE_TAIL_ENV, str);
+        }
+    }
+    env_int(DEVICE_TAIL_PPM_ENV, &prof->tail_ppm);
+    env_int(DEVICE_TAIL_US_ENV, &prof->tail_us);
+}
+/**
+ * @brief 填入默认磁盘参数，再用 DDRIVER_* 环境变量覆盖
+ * 
+ * @param opts 
+ */
+void ddriver_default_options(struct ddriver_options *opts) {
+    opts->disk_sz   = CONFIG_DISK_SZ;
+    opts->sector_sz = CONFIG_BLOCK_SZ;
+    opts->track_num = CONFIG_TRACKS;
+    ddriver_find_profile(CONFIG_PROFILE, &opts->profile);
+    opts->use_mmap  = 0;
+    opts->virtual_clock = 0;
+    opts->trace_path = NULL;
+    opts->trace_records = CONFIG_TRACE_RECORDS;
+
+    env_long(DEVICE_DISK_SZ_ENV, &opts->disk_sz);
+    env_int(DEVICE_SECTOR_SZ_ENV, &opts->sector_sz);
+    env_int(DEVICE_TRACKS_ENV, &opts->track_num);
+    env_profile(&opts->profile);
+    opts->use_mmap = env_flag(DEVICE_MMAP_ENV);
+    opts->virtual_clock = env_flag(DEVICE_VCLOCK_ENV);
+    if (getenv(DEVICE_TRACE_ENV) != NULL && getenv(DEVICE_TRACE_ENV)[0] != '\0') {
+        opts->trace_path = getenv(DEVICE_TRACE_ENV);
+    }
+    env_long(DEVICE_TRACE_RECORDS_ENV, &opts->trace_records);
+}
+/**
+ * @brief 检查磁盘参数：扇区为不小于512的2的幂，磁盘大小为扇区的整数倍且每个磁道至少一个扇区，
+ * 设备模型中的延迟都不为负
+ */
+static int check_options(const struct ddriver_options *opts) {
+    const struct ddriver_profile *prof;
+
+    if (opts->sector_sz < 512 || (opts->sector_sz & (opts->sector_sz - 1)) != 0) {
+        user_panic("sector size %d should be a power of 2 and >= 512", opts->sector_sz);
+        return -EINVAL;
+    }
+    if (opts->disk_sz <= 0 || opts->disk_sz % opts->sector_sz != 0) {
+        user_panic("disk size %ld should be a multiple of sector size %d",
+                   opts->disk_sz, opts->sector_sz);
+        return -EINVAL;
+    }
+    if (opts->track_num <= 0 || opts->disk_sz / opts->track_num < opts->sector_sz) {
+        user_panic("track num %d should be in [1, %ld]",
+                   opts->track_num, opts->disk_sz / opts->sector_sz);
+        return -EINVAL;
+    }
+    prof = &opts->profile;
+    if (prof->read_us < 0 || prof->seq_read_us < 0 || prof->write_us < 0 ||
+        prof->seq_write_us < 0 || prof->seek_min_us < 0 || prof->seek_max_us < prof->seek_min_us ||
+        prof->rotate_us < 0 || prof->bandwidth_mb < 0 || prof->tail_ppm < 0 || prof->tail_us < 0) {
+        user_panic("invalid latency in profile %s", prof->name ? prof->name : "(custom)");
+        return -EINVAL;
+    }
+    if (prof->parallel < 1) {
+        user_panic("device parallelism %d should be >= 1", prof->parallel);
+        return -EINVAL;
+    }
+    if (prof->tail_dist < DDRIVER_TAIL_NONE || prof->tail_dist > DDRIVER_TAIL_PARETO) {
+        user_panic("unknown tail distribution %d", prof->tail_dist);
+        return -EINVAL;
+    }
+    if (opts->trace_path != NULL && opts->trace_records <= 0) {
+        user_panic("trace records %ld should be positive", opts->trace_records);
+        return -EINVAL;
+    }
+    return 0;
+}
+/**
+ * @brief 以指定的磁盘参数打开任意路径下的磁盘镜像，日志写到 path_log
+ * 
+ * 镜像不存在时创建，比 disk_sz 小时扩展到 disk_sz
+ * 
+ * @param path 磁盘镜像路径
+ * @param opts 磁盘参数，NULL表示 ddriver_default_options 的结果
  * @return int 文件描述符
  */
-int ddriver_open(char *path) {
+int ddriver_open_ex(const char *path, const struct ddriver_options *opts) {
     int fd, ret = 0;
-    char device_path[128] = {0};
-    char log_path[128] = {0};
-    
-    sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
-    sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
-    
-    if (strcmp(device_path, path) != 0) {
-        user_panic("wrong path [%s], should be [%s]", path, device_path);
-        return -1;
-    }
+    struct stat st;
+    struct ddriver_options defaults;
+    char log_path[PATH_MAX] = {0};
 
-    if (access(device_path, F_OK) == 0) {
-        fd = open(device_path, O_RDWR);
+    if (opts == NULL) {
+        ddriver_default_options(&defaults);
+        opts = &defaults;
     }
-    else {
-        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    ret = check_options(opts);
+    if (ret < 0) {
+        return ret;
+    }
+    if (snprintf(log_path, sizeof(log_path), "%s_log", path) >= (int)sizeof(log_path)) {
+        user_panic("path too long [%s]", path);
+        return -ENAMETOOLONG;
     }
+
+    fd = open(path, O_CREAT | O_RDWR, 0644);
     if (fd < 0) {
-        user_panic("can't open device: %d", fd);
-        return fd;
+        ret = -errno;
+        user_panic("can't open device: %s", strerror(-ret));
+        return ret;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
-    if (ret < 0) {
-        user_panic("low space");
+    /* 稀疏镜像：只扩展文件大小，没写过的扇区不占宿主机的空间 */
+    if (fstat(fd, &st) < 0 || (st.st_size < opts->disk_sz && ftruncate(fd, opts->disk_sz) < 0)) {
+        ret = -errno;
+        user_panic("can't resize device: %s", strerror(errno));
+        close(fd);
         return ret;
     }
 
+    disk.layout_size = opts->disk_sz;
+    disk.iounit_size = opts->sector_sz;
+    disk.track_num   = opts->track_num;
+    disk.prof        = opts->profile;
+    disk.virtual_clock = opts->virtual_clock;
+
+    if (opts->use_mmap) {
+        disk.map = mmap(NULL, disk.layout_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (disk.map == MAP_FAILED) {
+            user_panic("can't mmap device: %s, fall back to read/write", strerror(errno));
+            disk.map = NULL;
+        }
+    }
+
+    if (opts->trace_path != NULL) {
+        ret = trace_open(opts->trace_path, opts->trace_records);
+        if (ret < 0) {
+            user_panic("can't open trace %s: %s, tracing disabled", opts->trace_path, strerror(-ret));
+        }
+    }
+
     debugf = fopen(log_path, "w+");
     if (debugf == NULL) {
+        ret = -errno;
         user_panic("can't init log: %s", log_path);
-        return -1;
+        /* 按相反顺序撤销，下次打开时不会沿用旧的映射 */
+        trace_close();
+        if (disk.map != NULL) {
+            munmap(disk.map, disk.layout_size);
+            disk.map = NULL;
+        }
+        close(fd);
+        return ret;
     }
 
     return fd;
 }
+/**
+ * @brief 打开驱动，磁盘参数可通过 DDRIVER_* 环境变量调整
+ * 
+ * @return int 文件描述符
+ */
+int ddriver_open(char *path) {
+    char device_path[128] = {0};
+    
+    sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
+    
+    if (strcmp(device_path, path) != 0) {
+        user_panic("wrong path [%s], should be [%s]", path, device_path);
+        return -1;
+    }
+
+    return ddriver_open_ex(path, NULL);
+}
 /**
  * @brief 关闭驱动
  * 
@@ -168,6 +1025,13 @@ int ddriver_open(char *path) {
  * @return int 
  */
 int ddriver_close(int fd) {
+    aio_stop();
+    trace_close();
+    if (disk.map != NULL) {
+        msync(disk.map, disk.layout_size, MS_SYNC);
+        munmap(disk.map, disk.layout_size);
+        disk.map = NULL;
+    }
     return close(fd) && fclose(debugf);
 }
 /**
@@ -179,12 +1043,13 @@ int ddriver_close(int fd) {
  * @return int 
  */
 int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+    off_t ret = 0;
+    off_t cur = 0;
+    long pos_us;
 
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
 
@@ -195,7 +1060,13 @@ int ddriver_seek(int fd, off_t offset, int whence){
         user_panic("seek error: %s", strerror(errno));
         return ret;
     }
-    emulate_rotate(fd, cur, ret);
+    __atomic_fetch_add(&disk.seek_dist, labs((long)ret - cur), __ATOMIC_RELAXED);
+    if (ret != cur) {
+        __atomic_store_n(&disk.seek_pending, 1, __ATOMIC_RELAXED);
+        trace_io(DDRIVER_TRACE_SEEK, ret, 0, 0);
+        pos_us = position_time(cur, ret);
+        emulate_delay(pos_us, pos_us);
+    }
     return ret;
 }
 /**
@@ -207,15 +1078,24 @@ int ddriver_seek(int fd, off_t offset, int whence){
  * @return int 
  */
 int ddriver_write(int fd, char *buf, size_t size){
+    struct iovec iov = {buf, size};
+    off_t cur;
+    long lat_us;
     int res = check_valid(size);
     if(res < 0)
         return res;
         
-    RW_DELAY(disk, write);
-    write(fd, buf, size);
+    queue_enter();
+    cur = lseek(fd, 0, SEEK_CUR);
+    trace_io(DDRIVER_REQ_WRITE, cur, size, 0);
+    lat_us = emulate_io(0, size, 1, !__atomic_exchange_n(&disk.seek_pending, 0, __ATOMIC_RELAXED));
+    res = dev_xfer_cur(fd, &iov, 1, size, 1);
+    queue_leave();
+    if (res < 0)
+        return res;
 
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    account_io(cur, size, 1, lat_us);
+    return disk.iounit_size;
 }
 /**
  * @brief 
@@ -226,15 +1106,246 @@ int ddriver_write(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_read(int fd, char *buf, size_t size){
+    struct iovec iov = {buf, size};
+    off_t cur;
+    long lat_us;
     int res = check_valid(size);
     if(res < 0)
         return res;
 
-    RW_DELAY(disk, read);
-    read(fd, buf, size);
+    queue_enter();
+    cur = lseek(fd, 0, SEEK_CUR);
+    trace_io(DDRIVER_REQ_READ, cur, size, 0);
+    lat_us = emulate_io(0, size, 0, !__atomic_exchange_n(&disk.seek_pending, 0, __ATOMIC_RELAXED));
+    res = dev_xfer_cur(fd, &iov, 1, size, 0);
+    queue_leave();
+    if (res < 0)
+        return res;
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    account_io(cur, size, 0, lat_us);
+    return disk.iounit_size;
+}
+/**
+ * @brief 磁盘连续写入多个扇区，一次请求只计一次延迟
+ * 
+ * @param fd 
+ * @param iov 每个iov_len都必须是扇区大小的整数倍
+ * @param iovcnt 
+ * @return int 写入的字节数
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt){
+    ssize_t size = check_valid_vec(iov, iovcnt);
+    off_t cur;
+    long lat_us;
+    int res;
+    if(size < 0)
+        return size;
+
+    queue_enter();
+    cur = lseek(fd, 0, SEEK_CUR);
+    trace_io(DDRIVER_REQ_WRITE, cur, size, 0);
+    lat_us = emulate_io(0, size, 1, !__atomic_exchange_n(&disk.seek_pending, 0, __ATOMIC_RELAXED));
+    res = dev_xfer_cur(fd, iov, iovcnt, size, 1);
+    queue_leave();
+    if (res < 0)
+        return res;
+
+    account_io(cur, size, 1, lat_us);
+    return size;
+}
+/**
+ * @brief 磁盘连续读出多个扇区，一次请求只计一次延迟
+ * 
+ * @param fd 
+ * @param iov 每个iov_len都必须是扇区大小的整数倍
+ * @param iovcnt 
+ * @return int 读出的字节数
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt){
+    ssize_t size = check_valid_vec(iov, iovcnt);
+    off_t cur;
+    long lat_us;
+    int res;
+    if(size < 0)
+        return size;
+
+    queue_enter();
+    cur = lseek(fd, 0, SEEK_CUR);
+    trace_io(DDRIVER_REQ_READ, cur, size, 0);
+    lat_us = emulate_io(0, size, 0, !__atomic_exchange_n(&disk.seek_pending, 0, __ATOMIC_RELAXED));
+    res = dev_xfer_cur(fd, iov, iovcnt, size, 0);
+    queue_leave();
+    if (res < 0)
+        return res;
+
+    account_io(cur, size, 0, lat_us);
+    return size;
+}
+/**
+ * @brief 在 offset 处写入一个扇区，不使用也不改变fd的文件偏移，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @param offset 必须对齐到扇区大小
+ * @return int 
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = {buf, size};
+    int res = check_valid(size);
+    if (res < 0 || (res = check_offset(offset)) < 0)
+        return res;
+
+    trace_io(DDRIVER_REQ_WRITE, offset, size, 0);
+    queue_enter();
+    res = dev_rw(fd, &iov, 1, offset, size, 1);
+    queue_leave();
+    return res;
+}
+/**
+ * @brief 从 offset 处读出一个扇区，不使用也不改变fd的文件偏移，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @param offset 必须对齐到扇区大小
+ * @return int 
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = {buf, size};
+    int res = check_valid(size);
+    if (res < 0 || (res = check_offset(offset)) < 0)
+        return res;
+
+    trace_io(DDRIVER_REQ_READ, offset, size, 0);
+    queue_enter();
+    res = dev_rw(fd, &iov, 1, offset, size, 0);
+    queue_leave();
+    return res;
+}
+/**
+ * @brief 从 offset 处连续写入多个扇区，writev 的定位版本
+ * 
+ * @param fd 
+ * @param iov 每个iov_len都必须是扇区大小的整数倍
+ * @param iovcnt 
+ * @param offset 必须对齐到扇区大小
+ * @return int 写入的字节数
+ */
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    ssize_t size = check_valid_vec(iov, iovcnt);
+    int res;
+    if (size < 0)
+        return size;
+    if (check_offset(offset) < 0)
+        return -EINVAL;
+
+    trace_io(DDRIVER_REQ_WRITE, offset, size, 0);
+    queue_enter();
+    res = dev_rw(fd, iov, iovcnt, offset, size, 1);
+    queue_leave();
+    return res;
+}
+/**
+ * @brief 从 offset 处连续读出多个扇区，readv 的定位版本
+ * 
+ * @param fd 
+ * @param iov 每个iov_len都必须是扇区大小的整数倍
+ * @param iovcnt 
+ * @param offset 必须对齐到扇区大小
+ * @return int 读出的字节数
+ */
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    ssize_t size = check_valid_vec(iov, iovcnt);
+    int res;
+    if (size < 0)
+        return size;
+    if (check_offset(offset) < 0)
+        return -EINVAL;
+
+    trace_io(DDRIVER_REQ_READ, offset, size, 0);
+    queue_enter();
+    res = dev_rw(fd, iov, iovcnt, offset, size, 0);
+    queue_leave();
+    return res;
+}
+/**
+ * @brief 异步提交一个定位读写请求，立即返回
+ * 
+ * 请求由服务线程按提交顺序取出执行，多个请求的模拟延迟在请求队列深度
+ * (IOC_REQ_DEVICE_QDEPTH) 允许的范围内互相重叠。完成后 req->res 为
+ * ddriver_preadv / pwritev 的返回值：设置了 req->done 则在服务线程中回调，
+ * 否则进入完成队列，由 ddriver_poll 取回。完成前 req 和 iov 都不能释放
+ * 
+ * @param fd 
+ * @param req op / iov / iovcnt / offset 须已填好
+ * @return int 0成功，小于0失败（请求未提交）
+ */
+int ddriver_submit(int fd, struct ddriver_req *req){
+    ssize_t size = check_valid_vec(req->iov, req->iovcnt);
+    int ret;
+    if (size < 0)
+        return size;
+    if (check_offset(req->offset) < 0)
+        return -EINVAL;
+
+    req->fd = fd;
+    req->res = 0;
+    req->next = NULL;
+    req->stamp = now_ms();
+    trace_io(req->op, req->offset, size, DDRIVER_TRACE_ASYNC);
+    pthread_mutex_lock(&aio.lock);
+    ret = aio_start();
+    if (ret < 0) {
+        pthread_mutex_unlock(&aio.lock);
+        return ret;
+    }
+    if (aio.sq_tail) {
+        aio.sq_tail->next = req;
+    }
+    else {
+        aio.sq_head = req;
+    }
+    aio.sq_tail = req;
+    pthread_cond_signal(&aio.sq_cond);
+    pthread_mutex_unlock(&aio.lock);
+    return 0;
+}
+/**
+ * @brief 取回已完成的请求（没有设置 done 回调的）
+ * 
+ * 完成队列由所有提交者共用，多个线程同时 poll 时可能取到别人的请求，
+ * 这种情况应使用 done 回调
+ * 
+ * @param fd 
+ * @param reqs 取回的请求，按完成顺序
+ * @param min_nr 至少等到这么多个请求完成，为0时不等待
+ * @param max_nr 最多取回的个数
+ * @return int 取回的请求数
+ */
+int ddriver_poll(int fd, struct ddriver_req **reqs, int min_nr, int max_nr){
+    int cnt = 0;
+    IGNORE_ARG(fd);
+
+    if (min_nr > max_nr) {
+        min_nr = max_nr;
+    }
+    pthread_mutex_lock(&aio.lock);
+    while (aio.cq_cnt < min_nr) {
+        pthread_cond_wait(&aio.cq_cond, &aio.lock);
+    }
+    while (cnt < max_nr && aio.cq_head != NULL) {
+        reqs[cnt] = aio.cq_head;
+        aio.cq_head = aio.cq_head->next;
+        reqs[cnt]->next = NULL;
+        cnt++;
+    }
+    if (aio.cq_head == NULL) {
+        aio.cq_tail = NULL;
+    }
+    aio.cq_cnt -= cnt;
+    pthread_mutex_unlock(&aio.lock);
+    return cnt;
 }
 /**
  * @brief 
@@ -246,32 +1357,109 @@ int ddriver_read(int fd, char *buf, size_t size){
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
     struct ddriver_state state;
+    struct ddriver_state_v2 *state2;
+    struct ddriver_range *range;
+    int size, i;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+        /* 超过 int 范围时只报告前 INT_MAX 字节（向下对齐到扇区），完整大小见 SIZE64 */
+        size = disk.layout_size > INT_MAX ? INT_MAX / disk.iounit_size * disk.iounit_size
+                                          : (int)disk.layout_size;
+        memcpy(arg, &size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size (64 bit) */
+        *(long long *)arg = disk.layout_size;
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = __atomic_load_n(&disk.read_cnt, __ATOMIC_RELAXED);
+        state.write_cnt = __atomic_load_n(&disk.write_cnt, __ATOMIC_RELAXED);
+        state.seek_cnt = __atomic_load_n(&disk.seek_cnt, __ATOMIC_RELAXED);
+        state.sim_us = __atomic_load_n(&disk.sim_us, __ATOMIC_RELAXED);
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
+    case IOC_REQ_DEVICE_STATE_V2:                     /* Device State, 64 bit with histograms */
+        state2 = (struct ddriver_state_v2 *)arg;
+        state2->read_cnt = __atomic_load_n(&disk.read_cnt, __ATOMIC_RELAXED);
+        state2->write_cnt = __atomic_load_n(&disk.write_cnt, __ATOMIC_RELAXED);
+        state2->seek_cnt = __atomic_load_n(&disk.seek_cnt, __ATOMIC_RELAXED);
+        state2->read_bytes = __atomic_load_n(&disk.read_bytes, __ATOMIC_RELAXED);
+        state2->write_bytes = __atomic_load_n(&disk.write_bytes, __ATOMIC_RELAXED);
+        state2->seek_dist = __atomic_load_n(&disk.seek_dist, __ATOMIC_RELAXED);
+        state2->sim_us = __atomic_load_n(&disk.sim_us, __ATOMIC_RELAXED);
+        for (i = 0; i < DDRIVER_LAT_BUCKETS; i++) {
+            state2->read_lat_hist[i] = __atomic_load_n(&disk.read_lat_hist[i], __ATOMIC_RELAXED);
+            state2->write_lat_hist[i] = __atomic_load_n(&disk.write_lat_hist[i], __ATOMIC_RELAXED);
+        }
+        state2->region_sz = heat_region_sz();
+        for (i = 0; i < DDRIVER_HEAT_REGIONS; i++) {
+            state2->read_heat[i] = __atomic_load_n(&disk.read_heat[i], __ATOMIC_RELAXED);
+            state2->write_heat[i] = __atomic_load_n(&disk.write_heat[i], __ATOMIC_RELAXED);
+        }
+        break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
+        /* 整盘打洞一次完成，与磁盘大小无关 */
+        dev_discard(fd, 0, disk.layout_size);
         lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
+        __atomic_store_n(&disk.read_cnt, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&disk.write_cnt, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&disk.seek_cnt, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&disk.read_bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&disk.write_bytes, 0, __ATOMIC_RELAXED);
+        for (i = 0; i < DDRIVER_LAT_BUCKETS; i++) {
+            __atomic_store_n(&disk.read_lat_hist[i], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&disk.write_lat_hist[i], 0, __ATOMIC_RELAXED);
         }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        for (i = 0; i < DDRIVER_HEAT_REGIONS; i++) {
+            __atomic_store_n(&disk.read_heat[i], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&disk.write_heat[i], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&disk.head, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&disk.seek_dist, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&disk.sim_us, 0, __ATOMIC_RELAXED);
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         memcpy(arg, &disk.iounit_size, sizeof(int));
         break;
+    case IOC_REQ_DEVICE_QDEPTH:                       /* Request Queue Depth */
+        if (*(int *)arg < 1) {
+            return -EINVAL;
+        }
+        pthread_mutex_lock(&queue_lock);
+        disk.queue_depth = *(int *)arg;
+        pthread_cond_broadcast(&queue_cond);
+        pthread_mutex_unlock(&queue_lock);
+        break;
+    case IOC_REQ_DEVICE_SCHED:                        /* Request Scheduler */
+        if (*(int *)arg < DDRIVER_SCHED_FIFO || *(int *)arg > DDRIVER_SCHED_DEADLINE) {
+            return -EINVAL;
+        }
+        pthread_mutex_lock(&aio.lock);
+        aio.sched = *(int *)arg;
+        pthread_mutex_unlock(&aio.lock);
+        break;
+    case IOC_REQ_DEVICE_SEEK_DIST:                    /* Total Seek Distance */
+        *(long *)arg = __atomic_load_n(&disk.seek_dist, __ATOMIC_RELAXED);
+        break;
+    case IOC_REQ_DEVICE_DISCARD:                      /* Discard Range */
+        range = (struct ddriver_range *)arg;
+        if (check_offset(range->offset) < 0 || range->len <= 0 || !IS_ADDR_ALIGN(range->len)
+            || range->offset + range->len > disk.layout_size) {
+            return -EINVAL;
+        }
+        trace_io(DDRIVER_TRACE_DISCARD, range->offset, range->len, 0);
+        return dev_discard(fd, range->offset, range->len);
+    case IOC_REQ_DEVICE_FLUSH:                        /* Flush To Backing File */
+        if (disk.map != NULL) {
+            return msync(disk.map, disk.layout_size, MS_SYNC) < 0 ? -EIO : 0;
+        }
+        return fsync(fd) < 0 ? -EIO : 0;
+    case IOC_REQ_DEVICE_SIM_TIME:                     /* Simulated Device Time */
+        *(long long *)arg = __atomic_load_n(&disk.sim_us, __ATOMIC_RELAXED);
+        break;
+    case IOC_REQ_DEVICE_VCLOCK:                       /* Switch Virtual Clock */
+        __atomic_store_n(&disk.virtual_clock, *(int *)arg != 0, __ATOMIC_RELAXED);
+        break;
     default:
         break;
     }
@@ -0,0 +1,301 @@
+/**
+ * @file ddriver_replay.c
+ * @brief 重放 DDRIVER_TRACE 记录的请求序列，报告吞吐量和模拟延迟
+ *
+ * 用法: ddriver_replay [-q qdepth] [-s fifo|scan|deadline] [-w window] [-t] <trace> <device>
+ *
+ * 设备以 ddriver_open_ex(device, NULL) 打开，磁盘大小、设备模型、虚拟时钟等
+ * 都取自环境变量 (DDRIVER_PROFILE / DDRIVER_VCLOCK ...)，同一份trace可以在
+ * 不同配置下反复重放。读写请求通过 ddriver_submit 异步提交，最多 window 个
+ * 同时在途，discard 同步执行；seek 记录和超出设备大小的请求跳过。写入的是无意义的数据，
+ * 不要对保存着文件系统的磁盘镜像重放。
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "ddriver.h"
+
+#define REPLAY_WINDOW           32          /* 默认同时在途的请求数 */
+
+struct replay_slot {
+    struct ddriver_req req;
+    struct iovec       iov;
+};
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-q qdepth] [-s fifo|scan|deadline] [-w window] [-t] <trace> <device>\n"
+                    "  -q  request queue depth (IOC_REQ_DEVICE_QDEPTH)\n"
+                    "  -s  request scheduler\n"
+                    "  -w  max outstanding requests, default %d\n"
+                    "  -t  honor recorded timestamps instead of replaying back to back\n",
+            prog, REPLAY_WINDOW);
+}
+
+/**
+ * @brief 读入整个trace文件并检查文件头
+ *
+ * @return struct ddriver_trace_hdr* 失败返回NULL
+ */
+static struct ddriver_trace_hdr *load_trace(const char *path) {
+    struct ddriver_trace_hdr *hdr;
+    FILE *fp = fopen(path, "rb");
+    long len;
+
+    if (fp == NULL) {
+        fprintf(stderr, "can't open trace %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if (len < (long)sizeof(struct ddriver_trace_hdr)) {
+        fprintf(stderr, "%s: too short for a trace\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    hdr = malloc(len);
+    if (hdr == NULL || fread(hdr, 1, len, fp) != (size_t)len) {
+        fprintf(stderr, "can't read trace %s\n", path);
+        free(hdr);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    if (memcmp(hdr->magic, DDRIVER_TRACE_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->version != DDRIVER_TRACE_VERSION
+        || hdr->rec_sz != sizeof(struct ddriver_trace_rec)
+        || hdr->capacity == 0
+        || (unsigned long long)len < sizeof(struct ddriver_trace_hdr) + hdr->capacity * hdr->rec_sz) {
+        fprintf(stderr, "%s: not a ddriver trace or unsupported version\n", path);
+        free(hdr);
+        return NULL;
+    }
+    return hdr;
+}
+
+/**
+ * @brief 由延迟直方图估算分位数，返回所在桶的上界 (us)
+ */
+static long long hist_percentile(const unsigned long long *hist, double pct) {
+    unsigned long long total = 0, acc = 0;
+    int i;
+
+    for (i = 0; i < DDRIVER_LAT_BUCKETS; i++) {
+        total += hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    for (i = 0; i < DDRIVER_LAT_BUCKETS; i++) {
+        acc += hist[i];
+        if (acc >= total * pct) {
+            break;
+        }
+    }
+    return 2LL << (i < DDRIVER_LAT_BUCKETS ? i : DDRIVER_LAT_BUCKETS - 1);
+}
+
+static int parse_sched(const char *name) {
+    if (strcmp(name, "fifo") == 0)
+        return DDRIVER_SCHED_FIFO;
+    if (strcmp(name, "scan") == 0)
+        return DDRIVER_SCHED_SCAN;
+    if (strcmp(name, "deadline") == 0)
+        return DDRIVER_SCHED_DEADLINE;
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    struct ddriver_trace_hdr *hdr;
+    struct ddriver_trace_rec *recs, *rec;
+    struct ddriver_state_v2 *before, *after;
+    struct ddriver_range range;
+    struct replay_slot *slots;
+    struct ddriver_req **free_slots, **done, *req;
+    unsigned long long first, cnt, i;
+    unsigned long long replayed = 0, skipped = 0, failed = 0, bytes = 0;
+    unsigned long long hist[DDRIVER_LAT_BUCKETS];
+    long long disk_sz, sim_before, sim_after, start, wall, sim, wait;
+    int qdepth = 0, sched = -1, window = REPLAY_WINDOW, timed = 0;
+    int fd, opt, inflight = 0, nfree, n, j;
+    unsigned int max_len = 0;
+    char *buf;
+
+    while ((opt = getopt(argc, argv, "q:s:w:th")) != -1) {
+        switch (opt) {
+        case 'q':
+            qdepth = atoi(optarg);
+            break;
+        case 's':
+            sched = parse_sched(optarg);
+            if (sched < 0) {
+                fprintf(stderr, "unknown scheduler %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 't':
+            timed = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind != 2 || window < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    hdr = load_trace(argv[optind]);
+    if (hdr == NULL) {
+        return 1;
+    }
+    recs = (struct ddriver_trace_rec *)(hdr + 1);
+    /* 写满后 next 之后的位置是最旧的记录 */
+    cnt = hdr->next < hdr->capacity ? hdr->next : hdr->capacity;
+    first = hdr->next < hdr->capacity ? 0 : hdr->next % hdr->capacity;
+    for (i = 0; i < cnt; i++) {
+        if (recs[i].len > max_len) {
+            max_len = recs[i].len;
+        }
+    }
+
+    fd = ddriver_open_ex(argv[optind + 1], NULL);
+    if (fd < 0) {
+        fprintf(stderr, "can't open device %s\n", argv[optind + 1]);
+        return 1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE64, &disk_sz);
+    if (qdepth > 0 && ddriver_ioctl(fd, IOC_REQ_DEVICE_QDEPTH, &qdepth) < 0) {
+        fprintf(stderr, "invalid queue depth %d\n", qdepth);
+        return 1;
+    }
+    if (sched >= 0) {
+        ddriver_ioctl(fd, IOC_REQ_DEVICE_SCHED, &sched);
+    }
+
+    slots = calloc(window, sizeof(struct replay_slot));
+    free_slots = calloc(window, sizeof(struct ddriver_req *));
+    done = calloc(window, sizeof(struct ddriver_req *));
+    buf = calloc(1, max_len > 0 ? max_len : 1);
+    before = malloc(sizeof(struct ddriver_state_v2));
+    after = malloc(sizeof(struct ddriver_state_v2));
+    if (!slots || !free_slots || !done || !buf || !before || !after) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    /* 所有写请求共用同一块缓冲区，读请求也读进这里，内容不关心 */
+    for (j = 0; j < window; j++) {
+        slots[j].iov.iov_base = buf;
+        slots[j].req.iov = &slots[j].iov;
+        slots[j].req.iovcnt = 1;
+        free_slots[j] = &slots[j].req;
+    }
+    nfree = window;
+
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE_V2, before);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIM_TIME, &sim_before);
+    start = now_us();
+    for (i = 0; i < cnt; i++) {
+        rec = &recs[(first + i) % hdr->capacity];
+        if (rec->op == DDRIVER_TRACE_SEEK || rec->len == 0
+            || rec->offset < 0 || rec->offset + rec->len > disk_sz) {
+            skipped++;
+            continue;
+        }
+        if (timed) {
+            wait = start + (long long)(rec->ts_us - recs[first].ts_us) - now_us();
+            if (wait > 0) {
+                usleep(wait);
+            }
+        }
+        if (rec->op == DDRIVER_TRACE_DISCARD) {
+            range.offset = rec->offset;
+            range.len = rec->len;
+            if (ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &range) < 0) {
+                failed++;
+            }
+            replayed++;
+            continue;
+        }
+        while (nfree == 0) {
+            n = ddriver_poll(fd, done, 1, window);
+            for (j = 0; j < n; j++) {
+                if (done[j]->res < 0) {
+                    failed++;
+                }
+                free_slots[nfree++] = done[j];
+            }
+            inflight -= n;
+        }
+
+        req = free_slots[--nfree];
+        ((struct replay_slot *)req)->iov.iov_len = rec->len;
+        req->op = rec->op;
+        req->offset = rec->offset;
+        req->done = NULL;
+        if (ddriver_submit(fd, req) < 0) {
+            failed++;
+            free_slots[nfree++] = req;
+            continue;
+        }
+        inflight++;
+        replayed++;
+        bytes += rec->len;
+    }
+    while (inflight > 0) {
+        n = ddriver_poll(fd, done, 1, window);
+        for (j = 0; j < n; j++) {
+            if (done[j]->res < 0) {
+                failed++;
+            }
+        }
+        inflight -= n;
+    }
+    wall = now_us() - start;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIM_TIME, &sim_after);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE_V2, after);
+    sim = sim_after - sim_before;
+
+    printf("records:   %llu replayed, %llu skipped, %llu failed\n", replayed, skipped, failed);
+    printf("bytes:     %llu (read %llu, write %llu)\n", bytes,
+           after->read_bytes - before->read_bytes, after->write_bytes - before->write_bytes);
+    printf("wall:      %.3f s, %.2f MB/s, %.0f IOPS\n", wall / 1e6,
+           wall > 0 ? bytes / (double)wall : 0.0, wall > 0 ? replayed * 1e6 / wall : 0.0);
+    printf("simulated: %.3f s, %.2f MB/s, %.0f IOPS\n", sim / 1e6,
+           sim > 0 ? bytes / (double)sim : 0.0, sim > 0 ? replayed * 1e6 / sim : 0.0);
+    for (j = 0; j < DDRIVER_LAT_BUCKETS; j++) {
+        hist[j] = after->read_lat_hist[j] - before->read_lat_hist[j];
+    }
+    printf("read lat:  p50 < %lld us, p99 < %lld us\n",
+           hist_percentile(hist, 0.50), hist_percentile(hist, 0.99));
+    for (j = 0; j < DDRIVER_LAT_BUCKETS; j++) {
+        hist[j] = after->write_lat_hist[j] - before->write_lat_hist[j];
+    }
+    printf("write lat: p50 < %lld us, p99 < %lld us\n",
+           hist_percentile(hist, 0.50), hist_percentile(hist, 0.99));
+
+    ddriver_close(fd);
+    free(before);
+    free(after);
+    free(buf);
+    free(done);
+    free(free_slots);
+    free(slots);
+    free(hdr);
+    return failed > 0;
+}
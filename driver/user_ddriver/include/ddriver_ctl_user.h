@@ -2,6 +2,7 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/uio.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -11,11 +12,137 @@ struct ddriver_state
     int write_cnt;
     int read_cnt;
     int seek_cnt;
+    long long sim_us;
+};
+
+#define DDRIVER_LAT_BUCKETS     32
+#define DDRIVER_HEAT_REGIONS    64
+
+struct ddriver_state_v2
+{
+    unsigned long long read_cnt;
+    unsigned long long write_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long seek_dist;
+    long long          sim_us;
+    unsigned long long read_lat_hist[DDRIVER_LAT_BUCKETS];
+    unsigned long long write_lat_hist[DDRIVER_LAT_BUCKETS];
+    long long          region_sz;
+    unsigned long long read_heat[DDRIVER_HEAT_REGIONS];
+    unsigned long long write_heat[DDRIVER_HEAT_REGIONS];
+};
+
+struct ddriver_range
+{
+    long long offset;
+    long long len;
 };
 
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_QDEPTH   _IOW(IOC_MAGIC, 4, int)
+#define IOC_REQ_DEVICE_SCHED    _IOW(IOC_MAGIC, 5, int)
+#define IOC_REQ_DEVICE_SEEK_DIST _IOR(IOC_MAGIC, 6, long)
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 7)
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 8, long long)
+#define IOC_REQ_DEVICE_SIM_TIME _IOR(IOC_MAGIC, 9, long long)
+#define IOC_REQ_DEVICE_VCLOCK   _IOW(IOC_MAGIC, 10, int)
+#define IOC_REQ_DEVICE_STATE_V2 _IOR(IOC_MAGIC, 11, struct ddriver_state_v2)
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 12, struct ddriver_range)
+
+/******************************************************************************
+* SECTION: Async request definitions
+*******************************************************************************/
+#define DDRIVER_REQ_READ        0
+#define DDRIVER_REQ_WRITE       1
+
+#define DDRIVER_SCHED_FIFO      0
+#define DDRIVER_SCHED_SCAN      1
+#define DDRIVER_SCHED_DEADLINE  2
+
+struct ddriver_req
+{
+    int                 fd;
+    int                 op;
+    const struct iovec *iov;
+    int                 iovcnt;
+    off_t               offset;
+    int                 res;
+    void              (*done)(struct ddriver_req *req);
+    void               *private;
+    struct ddriver_req *next;
+    long long           stamp;
+};
+
+/******************************************************************************
+* SECTION: Disk geometry definitions
+*******************************************************************************/
+#define DDRIVER_TAIL_NONE       0
+#define DDRIVER_TAIL_EXP        1
+#define DDRIVER_TAIL_PARETO     2
+
+struct ddriver_profile
+{
+    const char *name;
+    int  read_us;
+    int  seq_read_us;
+    int  write_us;
+    int  seq_write_us;
+    int  seek_min_us;
+    int  seek_max_us;
+    int  rotate_us;
+    int  bandwidth_mb;
+    int  parallel;
+    int  tail_dist;
+    int  tail_ppm;
+    int  tail_us;
+};
+
+struct ddriver_options
+{
+    long disk_sz;
+    int  sector_sz;
+    int  track_num;
+    struct ddriver_profile profile;
+    int  use_mmap;
+    int  virtual_clock;
+    const char *trace_path;
+    long trace_records;
+};
+
+/******************************************************************************
+* SECTION: Trace definitions
+*******************************************************************************/
+#define DDRIVER_TRACE_MAGIC     "DDTRACE1"
+#define DDRIVER_TRACE_VERSION   1
+#define DDRIVER_TRACE_SEEK      2
+#define DDRIVER_TRACE_DISCARD   3
+#define DDRIVER_TRACE_ASYNC     0x1
+
+struct ddriver_trace_hdr
+{
+    char               magic[8];
+    unsigned int       version;
+    unsigned int       rec_sz;
+    unsigned long long capacity;
+    unsigned long long next;
+    long long          disk_sz;
+    int                sector_sz;
+    int                reserved;
+};
+
+struct ddriver_trace_rec
+{
+    unsigned long long ts_us;
+    long long          offset;
+    unsigned int       len;
+    unsigned char      op;
+    unsigned char      flags;
+    unsigned short     reserved;
+};
 
 #endif
\ No newline at end of file
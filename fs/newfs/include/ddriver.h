@@ -3,6 +3,7 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 /**
  * @brief 打开ddriver设备
@@ -12,6 +13,35 @@
  */
 int ddriver_open(const char *path);
 
+/**
+ * @brief 以指定的磁盘参数打开任意路径下的磁盘镜像，镜像不存在时创建
+ * 
+ * @param path 磁盘镜像路径，日志写到 path_log
+ * @param opts 磁盘参数，NULL表示使用 ddriver_default_options 的结果
+ * @return int 文件描述符，小于0失败
+ */
+int ddriver_open_ex(const char *path, const struct ddriver_options *opts);
+
+/**
+ * @brief 填入默认磁盘参数 (4MB，512B扇区，classic设备模型)，再用环境变量
+ * DDRIVER_DISK_SZ / DDRIVER_SECTOR_SZ / DDRIVER_TRACKS / DDRIVER_PROFILE /
+ * DDRIVER_READ_LAT / DDRIVER_WRITE_LAT / DDRIVER_SEEK_LAT / DDRIVER_PARALLEL /
+ * DDRIVER_TAIL / DDRIVER_TAIL_PPM / DDRIVER_TAIL_US / DDRIVER_MMAP / DDRIVER_VCLOCK /
+ * DDRIVER_TRACE / DDRIVER_TRACE_RECORDS 覆盖，延迟单位均为 us。ddriver_open 也使用这组参数
+ * 
+ * @param opts 
+ */
+void ddriver_default_options(struct ddriver_options *opts);
+
+/**
+ * @brief 按名字查找内置设备模型
+ * 
+ * @param name classic (原来的4ms硬盘模型) / hdd / sata_ssd / nvme
+ * @param prof 找到时复制到这里，可再调整后放进 ddriver_options 传给 ddriver_open_ex
+ * @return int 0成功，否则没有这个模型
+ */
+int ddriver_find_profile(const char *name, struct ddriver_profile *prof);
+
 /**
  * @brief 移动ddriver磁盘头
  * 
@@ -42,6 +72,93 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 从磁盘头位置连续写入多个扇区，只计一次写延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要写入的Buf数组，每段长度必须是设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @return int 写入的字节数，小于0失败
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 从磁盘头位置连续读出多个扇区，只计一次读延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要读出的Buf数组，每段长度必须是设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @return int 读出的字节数，小于0失败
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 在 offset 处写入一个扇区，不改变磁盘头位置，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的Buf
+ * @param size 必须等于设备IO单位
+ * @param offset 写入位置，必须对齐到设备IO单位
+ * @return int 写入的字节数，小于0失败
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 从 offset 处读出一个扇区，不改变磁盘头位置，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的Buf
+ * @param size 必须等于设备IO单位
+ * @param offset 读出位置，必须对齐到设备IO单位
+ * @return int 读出的字节数，小于0失败
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 从 offset 处连续写入多个扇区，ddriver_writev 的定位版本
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要写入的Buf数组，每段长度必须是设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @param offset 写入位置，必须对齐到设备IO单位
+ * @return int 写入的字节数，小于0失败
+ */
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief 从 offset 处连续读出多个扇区，ddriver_readv 的定位版本
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要读出的Buf数组，每段长度必须是设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @param offset 读出位置，必须对齐到设备IO单位
+ * @return int 读出的字节数，小于0失败
+ */
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief 异步提交一个定位读写请求，立即返回
+ * 
+ * 完成后 req->res 为读写的字节数；设置了 req->done 时在驱动线程中回调，
+ * 否则进入完成队列，由 ddriver_poll 取回。完成前 req 和 iov 都不能释放
+ * 
+ * @param fd ddriver设备handler
+ * @param req 已填好 op / iov / iovcnt / offset 的请求
+ * @return int 0成功，小于0失败
+ */
+int ddriver_submit(int fd, struct ddriver_req *req);
+
+/**
+ * @brief 取回已完成的异步请求，完成队列由所有提交者共用
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 取回的请求
+ * @param min_nr 至少等到这么多个请求完成，为0时不等待
+ * @param max_nr 最多取回的个数
+ * @return int 取回的请求数
+ */
+int ddriver_poll(int fd, struct ddriver_req **reqs, int min_nr, int max_nr);
+
 /**
  * @brief ddriver IO控制
  * 
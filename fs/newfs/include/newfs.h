@@ -9,6 +9,7 @@
 #include "string.h"
 #include "fuse.h"
 #include <stddef.h>
+#include <pthread.h>
 #include "ddriver.h"
 #include "errno.h"
 #include "types.h"
@@ -22,22 +23,90 @@
 *******************************************************************************/
 char* 			   nfs_get_fname(const char* path);
 int 			   nfs_calc_lvl(const char * path);
+uint32_t 		   nfs_hash_fname(const char * fname);
+struct nfs_dentry* new_dentry(const char * fname, NFS_FILE_TYPE ftype);
 int 			   nfs_driver_read(int start, uint8_t *out_content, int size);
 int 			   nfs_driver_write(int dst, uint8_t *in_content, int size);
 
 int 			   nfs_mount(struct custom_options options);
 int 			   nfs_umount();
 
+int 			   nfs_dir_append(struct nfs_inode * inode, const char * fname, int ino,
+								  NFS_FILE_TYPE ftype);
+struct nfs_dentry* nfs_dir_dentry(struct nfs_inode * inode, int idx);
+void 			   nfs_dir_release_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
+void 			   nfs_dir_update(struct nfs_inode * inode, struct nfs_dentry * dentry);
+void 			   nfs_dir_free(struct nfs_inode * inode);
 int 			   nfs_alloc_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 int 			   nfs_drop_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 struct nfs_inode*  nfs_alloc_inode(struct nfs_dentry * dentry);
+int 			   nfs_bmap(struct nfs_inode * inode, int blk_idx);
+int 			   nfs_inode_grow(struct nfs_inode * inode, int blk_cnt);
+void 			   nfs_inode_shrink(struct nfs_inode * inode, int blk_cnt);
+int 			   nfs_load_data(struct nfs_inode * inode, int offset, int size, boolean is_write);
+boolean 		   nfs_data_loaded(struct nfs_inode * inode, int offset, int size);
 int 			   nfs_sync_inode(struct nfs_inode * inode);
+void 			   nfs_mark_inode_dirty(struct nfs_inode * inode);
+void 			   nfs_mark_sub_dirty(struct nfs_inode * inode);
+void 			   nfs_mark_data_dirty(struct nfs_inode * inode, int blk_idx);
 int 			   nfs_drop_inode(struct nfs_inode * inode);
+int 			   nfs_drop_orphan(struct nfs_inode * inode);
 struct nfs_inode*  nfs_read_inode(struct nfs_dentry * dentry, int ino);
-struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir);
+struct nfs_dirent* nfs_get_dirent(struct nfs_inode * inode, int dir);
+struct nfs_dentry* nfs_find_dentry(struct nfs_inode * inode, const char * fname);
 
 struct nfs_dentry* nfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 /******************************************************************************
+* SECTION: bitmap.c
+*******************************************************************************/
+int 			   nfs_bitmap_find_zero(const uint8_t *map, int nbits, int hint);
+void 			   nfs_bitmap_set(uint8_t *map, int idx);
+void 			   nfs_bitmap_clear(uint8_t *map, int idx);
+boolean 		   nfs_bitmap_test(const uint8_t *map, int idx);
+/******************************************************************************
+* SECTION: cache.c
+*******************************************************************************/
+int 			   nfs_cache_init();
+int 			   nfs_cache_read(int offset, uint8_t *out_content, int size);
+int 			   nfs_cache_write(int offset, uint8_t *in_content, int size);
+int 			   nfs_cache_prefetch(const int * blks, int cnt);
+int 			   nfs_cache_sync();
+int 			   nfs_cache_discard(int offset, int size);
+void 			   nfs_cache_destroy();
+/******************************************************************************
+* SECTION: dcache.c
+*******************************************************************************/
+int 			   nfs_dcache_init();
+struct nfs_dentry* nfs_dcache_lookup(const char * path, boolean * is_find);
+void 			   nfs_dcache_insert(const char * path, struct nfs_dentry * dentry, boolean is_find);
+void 			   nfs_dcache_invalidate(const char * path);
+void 			   nfs_dcache_forget(struct nfs_dentry * parent);
+void 			   nfs_dcache_drop(struct nfs_dentry * dentry);
+void 			   nfs_dcache_destroy();
+/******************************************************************************
+* SECTION: slab.c
+*******************************************************************************/
+void 			   nfs_slab_init(struct nfs_slab * slab, const char * name, int obj_sz);
+void* 			   nfs_slab_alloc(struct nfs_slab * slab);
+void* 			   nfs_slab_zalloc(struct nfs_slab * slab);
+void 			   nfs_slab_free(struct nfs_slab * slab, void * obj);
+void 			   nfs_slab_destroy(struct nfs_slab * slab);
+/******************************************************************************
+* SECTION: icache.c
+*******************************************************************************/
+void 			   nfs_icache_init(int budget_mb);
+void 			   nfs_icache_add(struct nfs_inode * inode);
+void 			   nfs_icache_remove(struct nfs_inode * inode);
+void 			   nfs_icache_move(struct nfs_inode * inode, struct nfs_dentry * dentry);
+void 			   nfs_icache_orphan(struct nfs_inode * inode);
+void 			   nfs_icache_charge(struct nfs_inode * inode, long bytes);
+void 			   nfs_icache_get(struct nfs_inode * inode);
+void 			   nfs_icache_put(struct nfs_inode * inode);
+void 			   nfs_icache_touch(struct nfs_inode * inode);
+void 			   nfs_icache_shrink();
+void 			   nfs_icache_drop_orphans();
+void 			   nfs_icache_destroy();
+/******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
 void* 			   newfs_init(struct fuse_conn_info *);
@@ -57,9 +126,13 @@ int   			   newfs_rmdir(const char *);
 int   			   newfs_rename(const char *, const char *);
 int   			   newfs_utimens(const char *, const struct timespec tv[2]);
 int   			   newfs_truncate(const char *, off_t);
+int   			   newfs_ftruncate(const char *, off_t, struct fuse_file_info *);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
+int   			   newfs_releasedir(const char *, struct fuse_file_info *);
 /******************************************************************************
 * SECTION: debug.c
 *******************************************************************************/
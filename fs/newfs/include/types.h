@@ -15,7 +15,7 @@ typedef enum NFS_file_type {
 #define UINT32_BITS             32
 #define UINT8_BITS              8
 
-#define NFS_MAGIC_NUM           0x8888
+#define NFS_MAGIC_NUM           0x888A
 #define NFS_SUPER_OFS           0
 #define NFS_ROOT_INO            0
 
@@ -33,7 +33,8 @@ typedef enum NFS_file_type {
 
 #define NFS_MAX_FILE_NAME       128
 #define NFS_INODE_PER_FILE      1
-#define NFS_DATA_PER_FILE       6
+#define NFS_DATA_PER_FILE       6       // 平均每个文件的数据块数，只用于估算布局
+#define NFS_EXTENT_PER_FILE     16      // inode内直接保存的extent数，其余放在一级/二级间接块
 #define NFS_DEFAULT_PERM        0777
 
 #define NFS_IOC_MAGIC           'S'
@@ -41,6 +42,29 @@ typedef enum NFS_file_type {
 
 #define NFS_FLAG_BUF_DIRTY      0x1
 #define NFS_FLAG_BUF_OCCUPY     0x2
+
+#define NFS_FLAG_INODE_DIRTY    0x1     // inode本身（含目录项）需要回写
+#define NFS_FLAG_INODE_SUB_DIRTY 0x2    // 子树中存在需要回写的inode
+#define NFS_FLAG_INODE_ORPHAN   0x4     // 已被删除但仍被打开，最后一次release时释放
+#define NFS_FLAG_INODE_DATA_DIRTY 0x8   // 有脏数据块，具体见data_dirty
+#define NFS_FLAG_INODE_EXTENT_DIRTY 0x10 // extent表有变化，需要重写间接块
+
+#define NFS_DIR_HASH_INIT       16      // 目录索引最小表长，保持表长不小于目录项数的2倍
+
+#define NFS_DCACHE_SZ           1024    // 路径缓存容量（条目数）
+#define NFS_DCACHE_BUCKETS      256     // 路径缓存哈希桶数
+
+#define NFS_CACHE_BLKS          256     // 块缓存容量（块数）
+#define NFS_CACHE_BUCKETS       64      // 块缓存哈希桶数
+#define NFS_CACHE_BATCH         32      // 未命中时单次合并读入的最大块数
+#define NFS_CACHE_FLUSH_SCAN    64      // 淘汰脏块时，从LRU尾部这么多块中收集脏块一起回写
+#define NFS_IO_DEPTH            8       // 挂载时设置的驱动请求队列深度，批量读写的请求可同时在途
+#define NFS_IO_SCHED            DDRIVER_SCHED_DEADLINE // 挂载时设置的驱动请求调度策略
+
+#define NFS_SLAB_CHUNK_SZ       (64 * 1024) // slab每次向系统申请的大小
+#define NFS_SLAB_ALIGN          16
+
+#define NFS_ICACHE_MB           64      // inode缓存默认内存预算 (MB)，--inode-cache-mb=0 不限
 /******************************************************************************
 * SECTION: Macro Function
 *******************************************************************************/
@@ -52,10 +76,30 @@ typedef enum NFS_file_type {
 #define NFS_ROUND_DOWN(value, round)    (value % round == 0 ? value : (value / round) * round)
 #define NFS_ROUND_UP(value, round)      (value % round == 0 ? value : ((value / round) + 1) * round)
 
-#define NFS_BLKS_SZ(blks)               (blks * NFS_BLK_SZ())
+#define NFS_BLKS_SZ(blks)               ((blks) * NFS_BLK_SZ())
 #define NFS_ASSIGN_FNAME(pnfs_dentry, _fname) memcpy(pnfs_dentry->fname, _fname, strlen(_fname))
 #define NFS_INO_OFS(ino)                (nfs_super.inode_offset + (ino) * NFS_BLK_SZ())
 #define NFS_DATA_OFS(data_blk)          (nfs_super.data_offset + (data_blk) * NFS_BLK_SZ())
+#define NFS_DIRENT_NAME(pinode, pdirent) ((pinode)->names + (pdirent)->name_off)
+#define NFS_DENTRY_PER_BLK()            (NFS_BLK_SZ() / (int)sizeof(struct nfs_dentry_d))
+#define NFS_EXTENT_PER_BLK()            (NFS_BLK_SZ() / (int)sizeof(struct nfs_extent))
+#define NFS_PTR_PER_BLK()               (NFS_BLK_SZ() / (int)sizeof(int))
+#define NFS_EXTENT_MAX()                (NFS_EXTENT_PER_FILE + NFS_EXTENT_PER_BLK() * (1 + NFS_PTR_PER_BLK()))
+
+#define NFS_SLAB_DENTRY()               (&nfs_super.dentry_slab)
+#define NFS_SLAB_INODE()                (&nfs_super.inode_slab)
+#define NFS_SLAB_BLK()                  (&nfs_super.blk_slab)
+
+#define NFS_TREE_LOCK()                 pthread_mutex_lock(&nfs_super.tree_lock)
+#define NFS_TREE_UNLOCK()               pthread_mutex_unlock(&nfs_super.tree_lock)
+#define NFS_ALLOC_LOCK()                pthread_mutex_lock(&nfs_super.alloc_lock)
+#define NFS_ALLOC_UNLOCK()              pthread_mutex_unlock(&nfs_super.alloc_lock)
+
+#define NFS_BUF_IS_DIRTY(pbuf)          ((pbuf)->flag & NFS_FLAG_BUF_DIRTY)
+#define NFS_BUF_IS_OCCUPY(pbuf)         ((pbuf)->flag & NFS_FLAG_BUF_OCCUPY)
+
+#define NFS_INODE_IS_DIRTY(pinode)      ((pinode)->flag & (NFS_FLAG_INODE_DIRTY | NFS_FLAG_INODE_DATA_DIRTY))
+#define NFS_INODE_IS_SUB_DIRTY(pinode)  ((pinode)->flag & NFS_FLAG_INODE_SUB_DIRTY)
 
 #define NFS_IS_DIR(pinode)              (pinode->dentry->ftype == NFS_DIR)
 #define NFS_IS_REG(pinode)              (pinode->dentry->ftype == NFS_REG_FILE)
@@ -67,8 +111,97 @@ struct nfs_dentry;
 struct nfs_inode;
 struct nfs_super;
 
+struct nfs_extent
+{
+    int                start;       // 起始数据块号
+    int                len;         // 连续块数
+};
+
+struct nfs_dirent
+{
+    uint32_t           hash;        // 文件名哈希
+    int                ino;
+    int                name_off;    // 文件名在目录 names 区中的偏移
+    uint8_t            name_len;
+    uint8_t            ftype;       // NFS_FILE_TYPE
+    struct nfs_dentry* dentry;      // 已建立的dentry，NULL表示只有记录
+};
+
+struct nfs_buf
+{
+    int                blk;         // 缓存的磁盘块号 (偏移 / BLK_SZ)
+    flag16             flag;        // NFS_FLAG_BUF_*
+    uint8_t*           data;        // 块内容
+    struct nfs_buf*    hash_next;   // 哈希桶链
+    struct nfs_buf*    prev;        // LRU链
+    struct nfs_buf*    next;
+};
+
+struct nfs_cache
+{
+    struct nfs_buf*    bufs;                        // 全部缓存块
+    struct nfs_buf*    buckets[NFS_CACHE_BUCKETS];  // 按块号索引
+    struct nfs_buf     lru;                         // 哨兵，lru.next最近使用，lru.prev最久未用
+    int                hit_cnt;
+    int                miss_cnt;
+    int                writeback_cnt;
+    int                rmw_avoid_cnt;               // 整块覆写而省掉的预读块数
+    int                prefetch_cnt;                // nfs_cache_prefetch 读入的块数
+    int                discard_cnt;                 // nfs_cache_discard 丢弃的块数
+    pthread_mutex_t    lock;                        // 缓存结构及其上的设备读写
+};
+
+struct nfs_dcache_entry
+{
+    char*                    path;      // 完整路径，NULL表示空闲
+    uint32_t                 hash;
+    boolean                  is_find;   // FALSE为负项，dentry为最后找到的父目录
+    struct nfs_dentry*       dentry;    // nfs_lookup的返回值
+    struct nfs_dcache_entry* hash_next;
+};
+
+struct nfs_dcache
+{
+    struct nfs_dcache_entry* entries;                     // 全部条目
+    struct nfs_dcache_entry* buckets[NFS_DCACHE_BUCKETS]; // 按路径索引
+    int                      clock;                       // 满时下一个被替换的条目
+    int                      hit_cnt;
+    int                      miss_cnt;
+};
+
+struct nfs_slab_chunk
+{
+    struct nfs_slab_chunk* next;    // 对象紧跟在头部之后
+};
+
+struct nfs_slab
+{
+    const char*        name;
+    int                obj_sz;      // 对齐后的对象大小
+    int                per_chunk;   // 每个chunk切出的对象数
+    void*              free_list;   // 空闲对象，首字存放下一个空闲对象
+    struct nfs_slab_chunk* chunks;
+    int                chunk_cnt;
+    int                in_use;
+    int                peak;
+    long               alloc_cnt;
+    pthread_mutex_t    lock;
+};
+
+struct nfs_icache
+{
+    struct nfs_inode*  lru_head;    // 最近使用
+    struct nfs_inode*  lru_tail;    // 最久未用，从这里开始淘汰
+    long               mem;         // 已缓存inode占用的内存（估算）
+    long               budget;      // 内存预算，<=0表示不限
+    int                inode_cnt;
+    int                evict_cnt;
+    int                writeback_cnt; // 淘汰前回写的脏inode数
+};
+
 struct custom_options {
 	const char* device;
+	int         inode_cache_mb;
 	boolean     show_help;
 };
 
@@ -91,45 +224,72 @@ struct nfs_super
     uint8_t*    map_data;           // data位图
     int         map_data_blks;      // data位图占用的块数
     int         map_data_offset;    // data位图起始地址
+    int         ino_hint;           // 下次分配inode时从这一位开始找
+    int         data_hint;          // 下次分配data块时从这一位开始找
 
     int         inode_offset;       // inode的起始地址
     int         data_offset;        // 数据块的起始地址
 
     struct nfs_dentry* root_dentry; // 根目录
+
+    struct nfs_cache   cache;       // 块缓存
+    struct nfs_dcache  dcache;      // 路径 -> dentry 缓存
+    struct nfs_icache  icache;      // 已读入的inode
+
+    struct nfs_slab    dentry_slab; // struct nfs_dentry
+    struct nfs_slab    inode_slab;  // struct nfs_inode
+    struct nfs_slab    blk_slab;    // BLK_SZ 大小的数据块缓冲
+
+    pthread_mutex_t    tree_lock;   // 目录树（目录inode及其目录项）、dcache、icache、引用计数
+    pthread_mutex_t    alloc_lock;  // inode/data 位图及分配提示
 };
 struct nfs_inode
 {
     int                ino;         // 在inod位图的索引
     int                size;        // 文件已占用大小
     int                dir_cnt;     // 如果是目录，其下的目录项
-    int                p_blk[NFS_DATA_PER_FILE];    //数据块指针
+    int                blk_cnt;     // 已分配的数据块数
+    int                extent_cnt;  // extents中有效项数
+    int                extent_cap;
+    struct nfs_extent* extents;     // 按文件块顺序排列的连续数据块，含间接块中的部分
+    int                ind_blk;     // 一级间接块（存extent），-1表示未分配
+    int                dind_blk;    // 二级间接块（存一级块号），-1表示未分配
+    int*               dind_blks;   // 二级间接块的内容，共dind_cnt项
+    int                dind_cnt;
+    int                bmap_ext;    // nfs_bmap上次命中的extent
+    int                bmap_base;   // 该extent对应的文件起始块
     struct nfs_dentry* dentry;      // 指向该inode的dentry
-    struct nfs_dentry* dentrys;     // 所有目录项 
-    uint8_t*           data[NFS_DATA_PER_FILE];
+    struct nfs_dirent* dirents;     // 目录项记录，按目录顺序连续存放，共dir_cnt项
+    int                dirent_cap;
+    char*              names;       // 目录项文件名区
+    int                names_len;
+    int                names_cap;
+    int                names_dead;  // 已删除目录项在names中留下的字节数
+    int*               dir_index;   // 按文件名哈希的开放寻址表，存dirents下标，-1为空，首次查找时建立
+    int                index_sz;
+    uint8_t**          data;        // 文件内容，data[i]对应文件第i块
+    int                data_cap;    // data可容纳的块数
     char               target_path[NFS_MAX_FILE_NAME];   // store traget path when it is a symlink
+    flag16             flag;        // NFS_FLAG_INODE_*
+    uint8_t*           data_dirty;  // 脏数据块位图，第i位对应data[i]
+    uint8_t*           data_resident; // 已调入内存的数据块位图，第i位对应data[i]
+    int                ref_cnt;     // 引用计数：fi->fh 及操作中临时持有，非0时不会被淘汰
+    int                child_cnt;   // 目录下已读入内存的inode数，非0时不会被淘汰
+    long               mem;         // 占用的内存：inode本身、目录项、已调入的数据块
+    struct nfs_inode*  lru_prev;    // inode缓存LRU链
+    struct nfs_inode*  lru_next;
+    pthread_rwlock_t   rwlock;      // 普通文件的数据、大小、extent及flag；目录由tree_lock保护
 };  
 
 struct nfs_dentry
 {
     char               fname[NFS_MAX_FILE_NAME];
     struct nfs_dentry* parent;                        /* 父亲Inode的dentry */
-    struct nfs_dentry* brother;                       /* 兄弟 */
     int                ino;
     struct nfs_inode*  inode;                         /* 指向inode */
     NFS_FILE_TYPE      ftype;
 };
 
-static inline struct nfs_dentry* new_dentry(char * fname, NFS_FILE_TYPE ftype) {
-    struct nfs_dentry * dentry = (struct nfs_dentry *)malloc(sizeof(struct nfs_dentry));
-    memset(dentry, 0, sizeof(struct nfs_dentry));
-    NFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;   
-    return dentry;                                         
-}
 /******************************************************************************
 * SECTION: FS Specific Structure - Disk structure
 *******************************************************************************/
@@ -155,7 +315,11 @@ struct nfs_inode_d
     int             size;            // 文件已占用空间
     int             link;            // 链接数
     int             dir_cnt;         // 如果是目录型文件，下面有几个目录项
-    int             p_blk[NFS_DATA_PER_FILE];      // 数据块指针
+    int             blk_cnt;         // 已分配的数据块数
+    int             extent_cnt;      // extents中有效项数
+    struct nfs_extent extents[NFS_EXTENT_PER_FILE]; // 数据块extent
+    int             ind_blk;         // 一级间接块，存放后续NFS_EXTENT_PER_BLK个extent
+    int             dind_blk;        // 二级间接块，存放一级间接块的块号
     NFS_FILE_TYPE   ftype;
     char            target_path[NFS_MAX_FILE_NAME];// store traget path when it is a symlink   
 };  
@@ -0,0 +1,98 @@
+#include "../include/newfs.h"
+
+/**
+ * 位图
+ *
+ * 与磁盘格式一致，第 i 位对应字节 i / 8 的第 i % 8 位（低位在前）。
+ * 查找时按 64 位字读取，全满的字整体跳过，字内用 ctz 直接定位第一个空闲位；
+ * 置位/清位按下标直接定位，不再逐位扫描。
+ */
+#define NFS_WORD_BITS                   64
+
+/**
+ * @brief 读出第 w 个 64 位字，超出 nbits 的部分视为已占用
+ */
+static uint64_t nfs_bitmap_load(const uint8_t *map, int w, int nbits)
+{
+    int nbytes = (nbits + UINT8_BITS - 1) / UINT8_BITS - w * 8;
+    int tail = nbits - w * NFS_WORD_BITS;
+    uint64_t word = 0;
+    int i;
+
+    if (nbytes >= 8)
+    {
+        memcpy(&word, map + w * 8, sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+    }
+    else
+    {
+        for (i = 0; i < nbytes; i++)
+            word |= (uint64_t)map[w * 8 + i] << (i * UINT8_BITS);
+    }
+    if (tail < NFS_WORD_BITS)
+        word |= ~0ULL << tail;
+    return word;
+}
+
+/**
+ * @brief 在 [begin, end) 内找第一个为0的位
+ */
+static int nfs_bitmap_scan(const uint8_t *map, int nbits, int begin, int end)
+{
+    int w = begin / NFS_WORD_BITS;
+    uint64_t free_bits;
+    int idx;
+
+    /* 起始字中 begin 之前的位不参与查找 */
+    free_bits = ~nfs_bitmap_load(map, w, nbits) & (~0ULL << (begin % NFS_WORD_BITS));
+    while (1)
+    {
+        if (free_bits != 0)
+        {
+            idx = w * NFS_WORD_BITS + __builtin_ctzll(free_bits);
+            return idx < end ? idx : -1;
+        }
+        if (++w * NFS_WORD_BITS >= end)
+            return -1;
+        free_bits = ~nfs_bitmap_load(map, w, nbits);
+    }
+}
+
+/**
+ * @brief 从 hint 开始（到末尾后回绕）查找第一个空闲位
+ *
+ * @param map 位图
+ * @param nbits 位图有效位数
+ * @param hint 开始查找的位置，通常为上次分配位置的下一位
+ * @return int 空闲位下标，位图已满返回-1
+ */
+int nfs_bitmap_find_zero(const uint8_t *map, int nbits, int hint)
+{
+    int idx;
+
+    if (nbits <= 0)
+        return -1;
+    if (hint < 0 || hint >= nbits)
+        hint = 0;
+    idx = nfs_bitmap_scan(map, nbits, hint, nbits);
+    if (idx < 0 && hint > 0)
+        idx = nfs_bitmap_scan(map, nbits, 0, hint);
+    return idx;
+}
+
+void nfs_bitmap_set(uint8_t *map, int idx)
+{
+    map[idx / UINT8_BITS] |= (uint8_t)(0x1 << (idx % UINT8_BITS));
+}
+
+void nfs_bitmap_clear(uint8_t *map, int idx)
+{
+    map[idx / UINT8_BITS] &= (uint8_t)(~(0x1 << (idx % UINT8_BITS)));
+}
+
+boolean nfs_bitmap_test(const uint8_t *map, int idx)
+{
+    return (map[idx / UINT8_BITS] >> (idx % UINT8_BITS)) & 0x1 ? TRUE : FALSE;
+}
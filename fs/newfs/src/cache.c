@@ -0,0 +1,512 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+#define NFS_CACHE()                     (&nfs_super.cache)
+
+/**
+ * 块缓存
+ *
+ * 以文件系统块 (BLK_SZ) 为单位缓存磁盘内容，nfs_driver_read / nfs_driver_write
+ * 都经过这里。命中直接拷贝，未命中时把连续缺失的块合并成一次向量读；
+ * 写入只置脏，等到被淘汰、fsync 或 umount 时才回写磁盘。
+ * 对外接口在 cache->lock 下执行；设备读写用带偏移的 ddriver_preadv / pwritev，
+ * 不依赖 fd 的磁头位置。批量的预读 (nfs_cache_prefetch) 和回写 (nfs_cache_sync)
+ * 一次提交多个异步请求再统一等待，模拟延迟互相重叠。驱动的完成队列是共用的，
+ * 只在 cache->lock 下提交和取回。
+ */
+static void nfs_lru_remove(struct nfs_buf *buf)
+{
+    buf->prev->next = buf->next;
+    buf->next->prev = buf->prev;
+}
+
+static void nfs_lru_push_front(struct nfs_buf *buf)
+{
+    struct nfs_buf *head = &NFS_CACHE()->lru;
+    buf->next = head->next;
+    buf->prev = head;
+    head->next->prev = buf;
+    head->next = buf;
+}
+
+static void nfs_hash_insert(struct nfs_buf *buf)
+{
+    struct nfs_buf **bucket = &NFS_CACHE()->buckets[buf->blk % NFS_CACHE_BUCKETS];
+    buf->hash_next = *bucket;
+    *bucket = buf;
+}
+
+static void nfs_hash_remove(struct nfs_buf *buf)
+{
+    struct nfs_buf **cursor = &NFS_CACHE()->buckets[buf->blk % NFS_CACHE_BUCKETS];
+    while (*cursor)
+    {
+        if (*cursor == buf)
+        {
+            *cursor = buf->hash_next;
+            break;
+        }
+        cursor = &(*cursor)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+static struct nfs_buf *nfs_cache_find(int blk)
+{
+    struct nfs_buf *buf = NFS_CACHE()->buckets[blk % NFS_CACHE_BUCKETS];
+    while (buf)
+    {
+        if (buf->blk == blk)
+            return buf;
+        buf = buf->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 从块号 blk 开始的连续块与 iov 之间做一次向量读/写
+ */
+static int nfs_dev_rw(int blk, struct iovec *iov, int iovcnt, boolean is_write)
+{
+    int size = iovcnt * NFS_BLK_SZ();
+    int ret;
+
+    if (is_write)
+        ret = ddriver_pwritev(NFS_DRIVER(), iov, iovcnt, NFS_BLKS_SZ(blk));
+    else
+        ret = ddriver_preadv(NFS_DRIVER(), iov, iovcnt, NFS_BLKS_SZ(blk));
+    return ret == size ? NFS_ERROR_NONE : -NFS_ERROR_IO;
+}
+
+static void nfs_dev_req(struct ddriver_req *req, int blk, struct iovec *iov, int iovcnt,
+                        boolean is_write)
+{
+    memset(req, 0, sizeof(struct ddriver_req));
+    req->op = is_write ? DDRIVER_REQ_WRITE : DDRIVER_REQ_READ;
+    req->iov = iov;
+    req->iovcnt = iovcnt;
+    req->offset = NFS_BLKS_SZ(blk);
+}
+
+static boolean nfs_dev_req_ok(struct ddriver_req *req)
+{
+    return req->res == req->iovcnt * NFS_BLK_SZ();
+}
+
+/**
+ * @brief 一起提交 reqs 中的请求并等待全部完成
+ *
+ * @return int 任一请求失败返回 -NFS_ERROR_IO，各请求的结果见 nfs_dev_req_ok
+ */
+static int nfs_dev_submit(struct ddriver_req *reqs, int cnt)
+{
+    struct ddriver_req *done[NFS_CACHE_BATCH];
+    int ret = NFS_ERROR_NONE;
+    int submitted, reaped, n, i;
+
+    for (submitted = 0; submitted < cnt; submitted++)
+    {
+        if (ddriver_submit(NFS_DRIVER(), &reqs[submitted]) < 0)
+        {
+            reqs[submitted].res = -1;
+            ret = -NFS_ERROR_IO;
+            break;
+        }
+    }
+    for (i = submitted + 1; i < cnt; i++)
+        reqs[i].res = -1;
+    for (reaped = 0; reaped < submitted; reaped += n)
+    {
+        n = submitted - reaped < NFS_CACHE_BATCH ? submitted - reaped : NFS_CACHE_BATCH;
+        n = ddriver_poll(NFS_DRIVER(), done, 1, n);
+        for (i = 0; i < n; i++)
+        {
+            if (!nfs_dev_req_ok(done[i]))
+                ret = -NFS_ERROR_IO;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief 从LRU尾部的 NFS_CACHE_FLUSH_SCAN 块中收集脏块，一起提交回写
+ *
+ * 淘汰脏块时调用。尾部的块很快也要被淘汰，一起提交后由驱动的调度器
+ * 按偏移排序派发，比逐块回写寻道更少
+ */
+static int nfs_cache_flush_tail()
+{
+    struct nfs_buf *dirty[NFS_CACHE_BATCH];
+    struct iovec iov[NFS_CACHE_BATCH];
+    struct ddriver_req reqs[NFS_CACHE_BATCH];
+    struct nfs_buf *buf = NFS_CACHE()->lru.prev;
+    int cnt = 0;
+    int ret, i;
+
+    for (i = 0; i < NFS_CACHE_FLUSH_SCAN && buf != &NFS_CACHE()->lru && cnt < NFS_CACHE_BATCH; i++)
+    {
+        if (NFS_BUF_IS_OCCUPY(buf) && NFS_BUF_IS_DIRTY(buf))
+        {
+            dirty[cnt] = buf;
+            iov[cnt].iov_base = buf->data;
+            iov[cnt].iov_len = NFS_BLK_SZ();
+            nfs_dev_req(&reqs[cnt], buf->blk, &iov[cnt], 1, TRUE);
+            cnt++;
+        }
+        buf = buf->prev;
+    }
+    ret = nfs_dev_submit(reqs, cnt);
+    for (i = 0; i < cnt; i++)
+    {
+        if (!nfs_dev_req_ok(&reqs[i]))
+            continue;
+        dirty[i]->flag &= ~NFS_FLAG_BUF_DIRTY;
+        NFS_CACHE()->writeback_cnt++;
+    }
+    return ret;
+}
+
+/**
+ * @brief 淘汰最久未用的块（脏块先回写），并把它重新绑定到 blk
+ *
+ * 返回的 buf 已挂入哈希表并放到 LRU 头部，但内容尚未填充
+ */
+static struct nfs_buf *nfs_buf_alloc(int blk)
+{
+    struct nfs_buf *buf = NFS_CACHE()->lru.prev;
+
+    if (NFS_BUF_IS_OCCUPY(buf))
+    {
+        if (NFS_BUF_IS_DIRTY(buf))
+            nfs_cache_flush_tail();
+        if (NFS_BUF_IS_DIRTY(buf))
+            return NULL;
+        nfs_hash_remove(buf);
+    }
+    buf->blk = blk;
+    buf->flag = NFS_FLAG_BUF_OCCUPY;
+    nfs_hash_insert(buf);
+    nfs_lru_remove(buf);
+    nfs_lru_push_front(buf);
+    return buf;
+}
+
+static void nfs_buf_release(struct nfs_buf *buf)
+{
+    nfs_hash_remove(buf);
+    buf->flag = 0;
+    /* 放回尾部，优先被复用 */
+    nfs_lru_remove(buf);
+    buf->prev = NFS_CACHE()->lru.prev;
+    buf->next = &NFS_CACHE()->lru;
+    NFS_CACHE()->lru.prev->next = buf;
+    NFS_CACHE()->lru.prev = buf;
+}
+
+/**
+ * @brief 在块 buf 与用户缓冲之间拷贝 [offset, offset + size) 落在该块内的部分
+ */
+static void nfs_buf_copy(struct nfs_buf *buf, int offset, uint8_t *content, int size,
+                         boolean is_write)
+{
+    int blk_begin = NFS_BLKS_SZ(buf->blk);
+    int begin = offset > blk_begin ? offset : blk_begin;
+    int end = offset + size < blk_begin + NFS_BLK_SZ() ? offset + size : blk_begin + NFS_BLK_SZ();
+
+    if (is_write)
+    {
+        memcpy(buf->data + (begin - blk_begin), content + (begin - offset), end - begin);
+        buf->flag |= NFS_FLAG_BUF_DIRTY;
+    }
+    else
+    {
+        memcpy(content + (begin - offset), buf->data + (begin - blk_begin), end - begin);
+    }
+}
+
+/**
+ * @brief 从磁盘填充一批块号连续的新缓存块
+ *
+ * 写操作时，被 [offset, offset + size) 完整覆盖的块马上会被整体覆写，
+ * 不需要先读（read-modify-write），只有首尾不完整的块才需要读入
+ */
+static int nfs_buf_fill(struct nfs_buf **batch, struct iovec *iov, int cnt,
+                        int offset, int size, boolean is_write)
+{
+    int begin, end, blk_begin;
+
+    for (begin = 0; begin < cnt; begin = end)
+    {
+        blk_begin = NFS_BLKS_SZ(batch[begin]->blk);
+        if (is_write && offset <= blk_begin && offset + size >= blk_begin + NFS_BLK_SZ())
+        {
+            NFS_CACHE()->rmw_avoid_cnt++;
+            end = begin + 1;
+            continue;
+        }
+        /* 需要读入的块也尽量合并 */
+        end = begin + 1;
+        while (end < cnt)
+        {
+            blk_begin = NFS_BLKS_SZ(batch[end]->blk);
+            if (is_write && offset <= blk_begin && offset + size >= blk_begin + NFS_BLK_SZ())
+                break;
+            end++;
+        }
+        if (nfs_dev_rw(batch[begin]->blk, iov + begin, end - begin, FALSE) != NFS_ERROR_NONE)
+            return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+
+static int nfs_cache_rw(int offset, uint8_t *content, int size, boolean is_write)
+{
+    struct nfs_buf *batch[NFS_CACHE_BATCH];
+    struct iovec iov[NFS_CACHE_BATCH];
+    struct nfs_buf *buf;
+    int blk = offset / NFS_BLK_SZ();
+    int blk_end = NFS_ROUND_UP((offset + size), NFS_BLK_SZ()) / NFS_BLK_SZ();
+    int cnt, i;
+
+    while (blk < blk_end)
+    {
+        buf = nfs_cache_find(blk);
+        if (buf)
+        {
+            NFS_CACHE()->hit_cnt++;
+            nfs_lru_remove(buf);
+            nfs_lru_push_front(buf);
+            nfs_buf_copy(buf, offset, content, size, is_write);
+            blk++;
+            continue;
+        }
+        /* 收集连续未命中的块，一次读入 */
+        cnt = 0;
+        while (blk + cnt < blk_end && cnt < NFS_CACHE_BATCH && nfs_cache_find(blk + cnt) == NULL)
+        {
+            batch[cnt] = nfs_buf_alloc(blk + cnt);
+            if (batch[cnt] == NULL)
+                break;
+            iov[cnt].iov_base = batch[cnt]->data;
+            iov[cnt].iov_len = NFS_BLK_SZ();
+            cnt++;
+        }
+        if (cnt == 0 || nfs_buf_fill(batch, iov, cnt, offset, size, is_write) != NFS_ERROR_NONE)
+        {
+            for (i = 0; i < cnt; i++)
+                nfs_buf_release(batch[i]);
+            return -NFS_ERROR_IO;
+        }
+        NFS_CACHE()->miss_cnt += cnt;
+        for (i = 0; i < cnt; i++)
+            nfs_buf_copy(batch[i], offset, content, size, is_write);
+        blk += cnt;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 分配缓存块，挂载时调用
+ */
+int nfs_cache_init()
+{
+    struct nfs_cache *cache = NFS_CACHE();
+    int i;
+
+    memset(cache, 0, sizeof(struct nfs_cache));
+    cache->bufs = (struct nfs_buf *)calloc(NFS_CACHE_BLKS, sizeof(struct nfs_buf));
+    if (cache->bufs == NULL)
+        return -NFS_ERROR_NOSPACE;
+    cache->lru.next = &cache->lru;
+    cache->lru.prev = &cache->lru;
+    pthread_mutex_init(&cache->lock, NULL);
+    for (i = 0; i < NFS_CACHE_BLKS; i++)
+    {
+        cache->bufs[i].data = (uint8_t *)malloc(NFS_BLK_SZ());
+        nfs_lru_push_front(&cache->bufs[i]);
+    }
+    return NFS_ERROR_NONE;
+}
+
+int nfs_cache_read(int offset, uint8_t *out_content, int size)
+{
+    int ret;
+
+    pthread_mutex_lock(&NFS_CACHE()->lock);
+    ret = nfs_cache_rw(offset, out_content, size, FALSE);
+    pthread_mutex_unlock(&NFS_CACHE()->lock);
+    return ret;
+}
+
+int nfs_cache_write(int offset, uint8_t *in_content, int size)
+{
+    int ret;
+
+    pthread_mutex_lock(&NFS_CACHE()->lock);
+    ret = nfs_cache_rw(offset, in_content, size, TRUE);
+    pthread_mutex_unlock(&NFS_CACHE()->lock);
+    return ret;
+}
+
+/**
+ * @brief 把 blks 中尚未缓存的块一起提交读入，之后的 nfs_cache_read 直接命中
+ *
+ * 块号相邻的合并为一个请求，一批最多 NFS_CACHE_BATCH 块。读失败的块不留在缓存中，
+ * 之后的读会重新访问磁盘
+ *
+ * @param blks 块号 (偏移 / BLK_SZ)，可以重复
+ */
+int nfs_cache_prefetch(const int *blks, int cnt)
+{
+    struct nfs_buf *batch[NFS_CACHE_BATCH];
+    struct iovec iov[NFS_CACHE_BATCH];
+    struct ddriver_req reqs[NFS_CACHE_BATCH];
+    struct ddriver_req *req;
+    struct nfs_buf *buf;
+    int ret = NFS_ERROR_NONE;
+    int filled, req_cnt, i, j, k;
+
+    pthread_mutex_lock(&NFS_CACHE()->lock);
+    for (i = 0; i < cnt && ret == NFS_ERROR_NONE;)
+    {
+        filled = 0;
+        req_cnt = 0;
+        for (; i < cnt && filled < NFS_CACHE_BATCH; i++)
+        {
+            if (nfs_cache_find(blks[i]) != NULL)
+                continue;
+            buf = nfs_buf_alloc(blks[i]);
+            if (buf == NULL)
+            {
+                ret = -NFS_ERROR_IO;
+                break;
+            }
+            batch[filled] = buf;
+            iov[filled].iov_base = buf->data;
+            iov[filled].iov_len = NFS_BLK_SZ();
+            if (req_cnt > 0 && batch[filled - 1]->blk + 1 == buf->blk)
+                reqs[req_cnt - 1].iovcnt++;
+            else
+                nfs_dev_req(&reqs[req_cnt++], buf->blk, &iov[filled], 1, FALSE);
+            filled++;
+        }
+        if (nfs_dev_submit(reqs, req_cnt) != NFS_ERROR_NONE)
+            ret = -NFS_ERROR_IO;
+        /* 读失败的请求中的块放回空闲 */
+        for (k = 0, req = reqs; req < reqs + req_cnt; k += req->iovcnt, req++)
+        {
+            if (nfs_dev_req_ok(req))
+            {
+                NFS_CACHE()->miss_cnt += req->iovcnt;
+                NFS_CACHE()->prefetch_cnt += req->iovcnt;
+                continue;
+            }
+            for (j = k; j < k + req->iovcnt; j++)
+                nfs_buf_release(batch[j]);
+        }
+    }
+    pthread_mutex_unlock(&NFS_CACHE()->lock);
+    return ret;
+}
+
+static int nfs_buf_cmp(const void *a, const void *b)
+{
+    return (*(struct nfs_buf **)a)->blk - (*(struct nfs_buf **)b)->blk;
+}
+
+/**
+ * @brief 回写全部脏块，块号连续的脏块合并为一次向量写，所有写请求一起提交
+ */
+int nfs_cache_sync()
+{
+    struct nfs_cache *cache = NFS_CACHE();
+    struct nfs_buf *dirty[NFS_CACHE_BLKS];
+    struct iovec iov[NFS_CACHE_BLKS];
+    struct ddriver_req reqs[NFS_CACHE_BLKS];
+    int dirty_cnt = 0;
+    int req_cnt = 0;
+    int ret;
+    int begin, end, i;
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < NFS_CACHE_BLKS; i++)
+    {
+        if (NFS_BUF_IS_OCCUPY(&cache->bufs[i]) && NFS_BUF_IS_DIRTY(&cache->bufs[i]))
+            dirty[dirty_cnt++] = &cache->bufs[i];
+    }
+    qsort(dirty, dirty_cnt, sizeof(struct nfs_buf *), nfs_buf_cmp);
+
+    for (begin = 0; begin < dirty_cnt; begin = end)
+    {
+        end = begin;
+        do
+        {
+            iov[end].iov_base = dirty[end]->data;
+            iov[end].iov_len = NFS_BLK_SZ();
+            end++;
+        } while (end < dirty_cnt && dirty[end]->blk == dirty[end - 1]->blk + 1);
+        nfs_dev_req(&reqs[req_cnt++], dirty[begin]->blk, &iov[begin], end - begin, TRUE);
+    }
+    ret = nfs_dev_submit(reqs, req_cnt);
+
+    /* 只有写成功的块才清除脏标记 */
+    for (i = 0, begin = 0; i < req_cnt; begin += reqs[i].iovcnt, i++)
+    {
+        if (!nfs_dev_req_ok(&reqs[i]))
+            continue;
+        for (end = begin; end < begin + reqs[i].iovcnt; end++)
+            dirty[end]->flag &= ~NFS_FLAG_BUF_DIRTY;
+        cache->writeback_cnt += reqs[i].iovcnt;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+/**
+ * @brief 丢弃 [offset, offset + size) 内的块，用于已释放的数据块
+ *
+ * 缓存中的副本（包括脏块）直接作废，不再回写，然后让驱动丢弃磁盘上的内容，
+ * 磁盘镜像中对应的部分不再占用宿主机的空间。驱动不支持时只作废缓存
+ *
+ * @param offset 块对齐
+ * @param size 块大小的整数倍
+ */
+int nfs_cache_discard(int offset, int size)
+{
+    struct ddriver_range range;
+    struct nfs_buf *buf;
+    int blk;
+
+    pthread_mutex_lock(&NFS_CACHE()->lock);
+    for (blk = offset / NFS_BLK_SZ(); blk < (offset + size) / NFS_BLK_SZ(); blk++)
+    {
+        buf = nfs_cache_find(blk);
+        if (buf != NULL)
+            nfs_buf_release(buf);
+    }
+    range.offset = offset;
+    range.len = size;
+    if (ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_DISCARD, &range) == 0)
+        NFS_CACHE()->discard_cnt += size / NFS_BLK_SZ();
+    pthread_mutex_unlock(&NFS_CACHE()->lock);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放缓存块，调用前应先 nfs_cache_sync
+ */
+void nfs_cache_destroy()
+{
+    struct nfs_cache *cache = NFS_CACHE();
+    int i;
+
+    NFS_DBG("cache hit: %d, miss: %d, writeback: %d, rmw avoided: %d, prefetch: %d, discard: %d\n",
+            cache->hit_cnt, cache->miss_cnt, cache->writeback_cnt, cache->rmw_avoid_cnt,
+            cache->prefetch_cnt, cache->discard_cnt);
+    for (i = 0; i < NFS_CACHE_BLKS; i++)
+        free(cache->bufs[i].data);
+    free(cache->bufs);
+    cache->bufs = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
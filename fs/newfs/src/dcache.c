@@ -0,0 +1,150 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+#define NFS_DCACHE()                    (&nfs_super.dcache)
+
+/**
+ * 路径缓存 (dcache)
+ *
+ * 以完整路径为键缓存 nfs_lookup 的结果，FUSE 回调对同一路径的反复
+ * getattr / access 只需一次哈希查找。查找失败也会缓存（负项），此时
+ * dentry 为最后找到的那一级，供 mknod / mkdir 作为父目录使用。
+ * 目录树发生变化时，由 nfs_dcache_invalidate 清除该路径及其下所有路径。
+ */
+static void nfs_dcache_unlink(struct nfs_dcache_entry *entry)
+{
+    struct nfs_dcache_entry **cursor = &NFS_DCACHE()->buckets[entry->hash % NFS_DCACHE_BUCKETS];
+    while (*cursor)
+    {
+        if (*cursor == entry)
+        {
+            *cursor = entry->hash_next;
+            break;
+        }
+        cursor = &(*cursor)->hash_next;
+    }
+    free(entry->path);
+    entry->path = NULL;
+    entry->hash_next = NULL;
+}
+
+int nfs_dcache_init()
+{
+    struct nfs_dcache *dcache = NFS_DCACHE();
+
+    memset(dcache, 0, sizeof(struct nfs_dcache));
+    dcache->entries = (struct nfs_dcache_entry *)calloc(NFS_DCACHE_SZ,
+                                                        sizeof(struct nfs_dcache_entry));
+    if (dcache->entries == NULL)
+        return -NFS_ERROR_NOSPACE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 查找路径缓存
+ *
+ * @return struct nfs_dentry* 未命中返回NULL，命中时 is_find 区分正项和负项
+ */
+struct nfs_dentry *nfs_dcache_lookup(const char *path, boolean *is_find)
+{
+    struct nfs_dcache_entry *entry;
+    uint32_t hash = nfs_hash_fname(path);
+
+    for (entry = NFS_DCACHE()->buckets[hash % NFS_DCACHE_BUCKETS]; entry; entry = entry->hash_next)
+    {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0)
+        {
+            NFS_DCACHE()->hit_cnt++;
+            *is_find = entry->is_find;
+            return entry->dentry;
+        }
+    }
+    NFS_DCACHE()->miss_cnt++;
+    return NULL;
+}
+
+/**
+ * @brief 记录一次 nfs_lookup 的结果，缓存满时按时钟顺序替换
+ */
+void nfs_dcache_insert(const char *path, struct nfs_dentry *dentry, boolean is_find)
+{
+    struct nfs_dcache *dcache = NFS_DCACHE();
+    struct nfs_dcache_entry *entry = &dcache->entries[dcache->clock];
+    struct nfs_dcache_entry **bucket;
+
+    dcache->clock = (dcache->clock + 1) % NFS_DCACHE_SZ;
+    if (entry->path != NULL)
+        nfs_dcache_unlink(entry);
+
+    entry->path = strdup(path);
+    entry->hash = nfs_hash_fname(path);
+    entry->is_find = is_find;
+    entry->dentry = dentry;
+    bucket = &dcache->buckets[entry->hash % NFS_DCACHE_BUCKETS];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+}
+
+/**
+ * @brief 清除 path 本身以及 path/ 下所有路径的缓存
+ */
+void nfs_dcache_invalidate(const char *path)
+{
+    struct nfs_dcache_entry *entry;
+    int len = strlen(path);
+    int i;
+
+    for (i = 0; i < NFS_DCACHE_SZ; i++)
+    {
+        entry = &NFS_DCACHE()->entries[i];
+        if (entry->path == NULL || strncmp(entry->path, path, len) != 0)
+            continue;
+        if (entry->path[len] == '\0' || entry->path[len] == '/')
+            nfs_dcache_unlink(entry);
+    }
+}
+
+/**
+ * @brief 清除指向 parent 子目录项的缓存，这些目录项即将随 parent 的inode一起释放
+ */
+void nfs_dcache_forget(struct nfs_dentry *parent)
+{
+    struct nfs_dcache_entry *entry;
+    int i;
+
+    for (i = 0; i < NFS_DCACHE_SZ; i++)
+    {
+        entry = &NFS_DCACHE()->entries[i];
+        if (entry->path != NULL && entry->dentry->parent == parent)
+            nfs_dcache_unlink(entry);
+    }
+}
+
+/**
+ * @brief 清除指向 dentry 的缓存（含负项），dentry即将被释放
+ */
+void nfs_dcache_drop(struct nfs_dentry *dentry)
+{
+    struct nfs_dcache_entry *entry;
+    int i;
+
+    for (i = 0; i < NFS_DCACHE_SZ; i++)
+    {
+        entry = &NFS_DCACHE()->entries[i];
+        if (entry->path != NULL && entry->dentry == dentry)
+            nfs_dcache_unlink(entry);
+    }
+}
+
+void nfs_dcache_destroy()
+{
+    struct nfs_dcache *dcache = NFS_DCACHE();
+    int i;
+
+    NFS_DBG("dcache hit: %d, miss: %d\n", dcache->hit_cnt, dcache->miss_cnt);
+    for (i = 0; i < NFS_DCACHE_SZ; i++)
+        free(dcache->entries[i].path);
+    free(dcache->entries);
+    dcache->entries = NULL;
+}
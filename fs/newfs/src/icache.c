@@ -0,0 +1,284 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+#define NFS_ICACHE()                    (&nfs_super.icache)
+
+/**
+ * inode缓存
+ *
+ * 读入内存的inode按最近使用顺序挂在LRU链上，每个inode记下自己占用的内存
+ * （inode本身、目录项、已调入的数据块）。总量超过预算时，在 nfs_lookup 开始处
+ * 从链尾淘汰没有被引用的inode，它的dentry也随之释放，只留下父目录中的记录，
+ * 下次查找时再建立dentry并由 nfs_read_inode 读入。
+ *
+ * 子目录项归目录inode所有，所以目录下还有已读入的inode时不淘汰该目录；
+ * 脏inode淘汰前先回写到块缓存。
+ *
+ * 除 nfs_icache_charge 外都在 tree_lock 下调用。读写文件数据时只持有该inode的
+ * rwlock，占用变化直接原子地累加到总量上。
+ */
+static boolean nfs_icache_linked(struct nfs_inode *inode)
+{
+    return inode->lru_prev != NULL || NFS_ICACHE()->lru_head == inode;
+}
+
+static void nfs_icache_unlink(struct nfs_inode *inode)
+{
+    struct nfs_icache *icache = NFS_ICACHE();
+
+    if (inode->lru_prev)
+        inode->lru_prev->lru_next = inode->lru_next;
+    else
+        icache->lru_head = inode->lru_next;
+    if (inode->lru_next)
+        inode->lru_next->lru_prev = inode->lru_prev;
+    else
+        icache->lru_tail = inode->lru_prev;
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+}
+
+static void nfs_icache_push_front(struct nfs_inode *inode)
+{
+    struct nfs_icache *icache = NFS_ICACHE();
+
+    inode->lru_prev = NULL;
+    inode->lru_next = icache->lru_head;
+    if (icache->lru_head)
+        icache->lru_head->lru_prev = inode;
+    else
+        icache->lru_tail = inode;
+    icache->lru_head = inode;
+}
+
+static struct nfs_inode *nfs_icache_parent(struct nfs_inode *inode)
+{
+    struct nfs_dentry *parent = inode->dentry->parent;
+    return parent != NULL ? parent->inode : NULL;
+}
+
+/**
+ * @brief 挂载时调用
+ *
+ * @param budget_mb 内存预算 (MB)，<=0表示不限
+ */
+void nfs_icache_init(int budget_mb)
+{
+    struct nfs_icache *icache = NFS_ICACHE();
+
+    memset(icache, 0, sizeof(struct nfs_icache));
+    icache->budget = (long)budget_mb * 1024 * 1024;
+}
+
+/**
+ * @brief 新分配或读入的inode加入缓存，inode->dentry 须已指向它的dentry
+ */
+void nfs_icache_add(struct nfs_inode *inode)
+{
+    struct nfs_icache *icache = NFS_ICACHE();
+    struct nfs_inode *parent = nfs_icache_parent(inode);
+
+    nfs_icache_charge(inode, sizeof(struct nfs_inode));
+    icache->inode_cnt++;
+    nfs_icache_push_front(inode);
+    if (parent != NULL)
+        parent->child_cnt++;
+}
+
+/**
+ * @brief 把inode移出缓存，之后由调用者释放
+ */
+void nfs_icache_remove(struct nfs_inode *inode)
+{
+    struct nfs_icache *icache = NFS_ICACHE();
+    struct nfs_inode *parent = nfs_icache_parent(inode);
+
+    if (!nfs_icache_linked(inode))
+        return;
+    __atomic_sub_fetch(&icache->mem, inode->mem, __ATOMIC_RELAXED);
+    icache->inode_cnt--;
+    nfs_icache_unlink(inode);
+    if (parent != NULL)
+        parent->child_cnt--;
+}
+
+/**
+ * @brief inode改挂到新的dentry下（rename），调整新旧父目录的计数
+ */
+void nfs_icache_move(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    struct nfs_inode *parent = nfs_icache_parent(inode);
+
+    if (parent != NULL)
+        parent->child_cnt--;
+    inode->dentry = dentry;
+    parent = nfs_icache_parent(inode);
+    if (parent != NULL)
+        parent->child_cnt++;
+}
+
+/**
+ * @brief inode已被删除但仍被打开：不再计入父目录，并断开与父目录的联系
+ *
+ * 父目录此后可能被删除释放，孤儿inode仍留在缓存中，最后一次release时才释放
+ */
+void nfs_icache_orphan(struct nfs_inode *inode)
+{
+    struct nfs_inode *parent = nfs_icache_parent(inode);
+
+    if (parent != NULL)
+        parent->child_cnt--;
+    inode->dentry->parent = NULL;
+}
+
+/**
+ * @brief 记录inode占用内存的变化
+ *
+ * 加入缓存前的占用同样计入总量，nfs_icache_remove 时整体扣除，之后不能再调用
+ */
+void nfs_icache_charge(struct nfs_inode *inode, long bytes)
+{
+    inode->mem += bytes;
+    __atomic_add_fetch(&NFS_ICACHE()->mem, bytes, __ATOMIC_RELAXED);
+}
+
+void nfs_icache_get(struct nfs_inode *inode)
+{
+    inode->ref_cnt++;
+}
+
+void nfs_icache_put(struct nfs_inode *inode)
+{
+    inode->ref_cnt--;
+}
+
+/**
+ * @brief 把inode及其祖先移到LRU头部
+ *
+ * 祖先排在子孙前面，淘汰时先淘汰子孙，目录随后即可淘汰
+ */
+void nfs_icache_touch(struct nfs_inode *inode)
+{
+    while (inode != NULL)
+    {
+        if (nfs_icache_linked(inode))
+        {
+            nfs_icache_unlink(inode);
+            nfs_icache_push_front(inode);
+        }
+        inode = nfs_icache_parent(inode);
+    }
+}
+
+static boolean nfs_icache_evictable(struct nfs_inode *inode)
+{
+    /* 没能释放的孤儿inode要留到下次重试，淘汰了就再也找不到它 */
+    return inode->ref_cnt == 0 && inode->child_cnt == 0 &&
+           !(inode->flag & NFS_FLAG_INODE_ORPHAN) &&
+           inode != nfs_super.root_dentry->inode;
+}
+
+/**
+ * @brief 释放inode，dentry回到未读入状态
+ */
+static void nfs_icache_evict(struct nfs_inode *inode)
+{
+    struct nfs_dentry *dentry = inode->dentry;
+    struct nfs_inode *parent = nfs_icache_parent(inode);
+    int i;
+
+    if (NFS_IS_DIR(inode))
+    {
+        /* 子目录项随目录一起释放，路径缓存中指向它们的条目也要清掉 */
+        nfs_dcache_forget(dentry);
+        nfs_dir_free(inode);
+    }
+    for (i = 0; inode->data != NULL && i < inode->blk_cnt; i++)
+        nfs_slab_free(NFS_SLAB_BLK(), inode->data[i]);
+    free(inode->data);
+    free(inode->data_dirty);
+    free(inode->data_resident);
+    free(inode->extents);
+    nfs_slab_free(NFS_SLAB_BLK(), inode->dind_blks);
+
+    nfs_icache_remove(inode);
+    dentry->inode = NULL;
+    pthread_rwlock_destroy(&inode->rwlock);
+    nfs_slab_free(NFS_SLAB_INODE(), inode);
+    NFS_ICACHE()->evict_cnt++;
+
+    /* dentry也退回父目录中的一条记录 */
+    if (parent != NULL)
+    {
+        nfs_dcache_drop(dentry);
+        nfs_dir_release_dentry(parent, dentry);
+    }
+}
+
+/**
+ * @brief 占用超过预算时，从LRU尾部淘汰inode直到回到预算以内
+ *
+ * 只在 nfs_lookup 开始处调用，此时上一次操作得到的inode都已不再使用；
+ * 需要跨多次查找持有的inode由调用者用 nfs_icache_get 固定
+ */
+void nfs_icache_shrink()
+{
+    struct nfs_icache *icache = NFS_ICACHE();
+    struct nfs_inode *victim = icache->lru_tail;
+    struct nfs_inode *prev;
+
+    if (icache->budget <= 0)
+        return;
+    while (victim != NULL && __atomic_load_n(&icache->mem, __ATOMIC_RELAXED) > icache->budget)
+    {
+        prev = victim->lru_prev;
+        if (nfs_icache_evictable(victim))
+        {
+            if (NFS_INODE_IS_DIRTY(victim) || NFS_INODE_IS_SUB_DIRTY(victim))
+            {
+                if (nfs_sync_inode(victim) != NFS_ERROR_NONE)
+                {
+                    victim = prev;
+                    continue;
+                }
+                icache->writeback_cnt++;
+            }
+            nfs_icache_evict(victim);
+        }
+        victim = prev;
+    }
+}
+
+/**
+ * @brief 卸载时释放仍留在缓存中的孤儿inode
+ */
+void nfs_icache_drop_orphans()
+{
+    struct nfs_inode *inode = NFS_ICACHE()->lru_head;
+
+    while (inode != NULL)
+    {
+        if (!(inode->flag & NFS_FLAG_INODE_ORPHAN))
+        {
+            inode = inode->lru_next;
+            continue;
+        }
+        if (nfs_drop_orphan(inode) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] drop orphan inode %d error\n", __func__, inode->ino);
+            inode = inode->lru_next;
+            continue;
+        }
+        /* 释放目录时其下的inode也随之移出，从头再找 */
+        inode = NFS_ICACHE()->lru_head;
+    }
+}
+
+void nfs_icache_destroy()
+{
+    struct nfs_icache *icache = NFS_ICACHE();
+
+    NFS_DBG("icache inodes: %d, mem: %ld, evict: %d, writeback: %d\n",
+            icache->inode_cnt, icache->mem, icache->evict_cnt, icache->writeback_cnt);
+}
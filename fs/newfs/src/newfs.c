@@ -6,6 +6,7 @@
 	}
 static const struct fuse_opt option_spec[] = {/* 用于FUSE文件系统解析参数 */
 											  OPTION("--device=%s", device),
+											  OPTION("--inode-cache-mb=%d", inode_cache_mb),
 											  FUSE_OPT_END};
 
 struct nfs_super nfs_super;
@@ -25,16 +26,97 @@ static struct fuse_operations operations = {
 	.read = newfs_read,			/* 读文件 */
 	.utimens = newfs_utimens,	/* 修改时间，忽略，避免touch报错 */
 	.truncate = newfs_truncate, /* 改变文件大小 */
+	.ftruncate = newfs_ftruncate, /* 按已打开的文件改变大小 */
 	.unlink = newfs_unlink,		/* 删除文件 */
 	.rmdir = newfs_rmdir,		/* 删除目录， rm -r */
 	.rename = newfs_rename,		/* 重命名，mv */
+	.fsync = newfs_fsync,		/* 刷写文件及块缓存 */
 
 	.open = newfs_open,
 	.opendir = newfs_opendir,
+	.release = newfs_release,
+	.releasedir = newfs_releasedir,
 	.access = newfs_access};
 /******************************************************************************
  * SECTION: 必做函数实现
  *******************************************************************************/
+/**
+ * 并发
+ *
+ * FUSE 以多线程方式运行，锁的顺序为 tree_lock -> inode->rwlock -> alloc_lock -> slab/cache，
+ * 持有inode的rwlock时不再申请tree_lock。
+ *  - tree_lock: 路径查找、目录的增删改、dcache / icache、引用计数
+ *  - inode->rwlock: 普通文件的读写与截断，不同文件之间互不影响
+ *  - alloc_lock: 位图；slab和块缓存各有自己的锁
+ * 读写前先在树锁下找到inode并增加引用计数，之后只持有该inode的rwlock。
+ */
+
+/**
+ * @brief 取得要操作的inode：已打开的文件直接用 fi->fh，否则在树锁下按路径查找并增加引用计数
+ *
+ * @param err 失败时的错误码，找不到为 -NFS_ERROR_NOTFOUND，读inode出错为 -NFS_ERROR_IO
+ * @return struct nfs_inode* 失败返回NULL，用完后调用 newfs_put_inode
+ */
+static struct nfs_inode *newfs_get_inode(const char *path, struct fuse_file_info *fi, int *err)
+{
+	boolean is_find, is_root;
+	struct nfs_dentry *dentry;
+	struct nfs_inode *inode = NULL;
+
+	if (fi != NULL && fi->fh != 0)
+	{
+		return (struct nfs_inode *)(uintptr_t)fi->fh;
+	}
+
+	NFS_TREE_LOCK();
+	dentry = nfs_lookup(path, &is_find, &is_root);
+	if (is_find)
+	{
+		inode = dentry->inode;
+		nfs_icache_get(inode);
+	}
+	else
+	{
+		*err = dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+	}
+	NFS_TREE_UNLOCK();
+	return inode;
+}
+
+/**
+ * @brief 减少引用计数，已被删除的文件在最后一个引用放回时释放
+ *
+ * @param is_dirty 持有期间是否写过，是则在树锁下补上祖先的“子树有脏inode”标记
+ */
+static void newfs_unref_inode(struct nfs_inode *inode, boolean is_dirty)
+{
+	NFS_TREE_LOCK();
+	if (is_dirty)
+	{
+		nfs_mark_sub_dirty(inode);
+	}
+	nfs_icache_put(inode);
+	/* 释放失败时保留孤儿标记，下一次release或卸载时再试 */
+	if (inode->ref_cnt == 0 && inode->flag & NFS_FLAG_INODE_ORPHAN &&
+		nfs_drop_orphan(inode) != NFS_ERROR_NONE)
+	{
+		NFS_DBG("[%s] drop orphan inode %d error\n", __func__, inode->ino);
+	}
+	NFS_TREE_UNLOCK();
+}
+
+/**
+ * @brief 放回 newfs_get_inode 取得的inode，fi->fh 的引用留到release
+ */
+static void newfs_put_inode(struct nfs_inode *inode, struct fuse_file_info *fi, boolean is_dirty)
+{
+	if (fi != NULL && fi->fh != 0)
+	{
+		return;
+	}
+	newfs_unref_inode(inode, is_dirty);
+}
+
 /**
  * @brief 挂载（mount）文件系统
  * @param conn_info 可忽略，一些建立连接相关的信息
@@ -66,21 +148,19 @@ void newfs_destroy(void *p)
 }
 
 /**
- * @brief 创建目录
- *
- * @param path 相对于挂载点的路径
- * @param mode 创建模式（只读？只写？），可忽略
- * @return int 0成功，否则失败
+ * @brief 在树锁下创建目录
  */
-int newfs_mkdir(const char *path, mode_t mode)
+static int newfs_do_mkdir(const char *path)
 {
-	(void)mode;
 	boolean is_find, is_root;
 	char *fname;
 	struct nfs_dentry *last_dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_dentry *dentry;
 	struct nfs_inode *inode;
 
+	if (last_dentry == NULL)
+		return -NFS_ERROR_IO;
+
 	if (is_find)
 		return -NFS_ERROR_EXISTS;
 
@@ -92,13 +172,33 @@ int newfs_mkdir(const char *path, mode_t mode)
 	dentry->parent = last_dentry;
 			
 	inode = nfs_alloc_inode(dentry);
-	nfs_sync_inode(inode);
+	nfs_mark_inode_dirty(inode);
 
 	nfs_alloc_dentry(last_dentry->inode, dentry);
+	nfs_mark_inode_dirty(last_dentry->inode);
+	nfs_dcache_invalidate(path);
 
 	return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 创建目录
+ *
+ * @param path 相对于挂载点的路径
+ * @param mode 创建模式（只读？只写？），可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_mkdir(const char *path, mode_t mode)
+{
+	(void)mode;
+	int ret;
+
+	NFS_TREE_LOCK();
+	ret = newfs_do_mkdir(path);
+	NFS_TREE_UNLOCK();
+	return ret;
+}
+
 /**
  * @brief 获取文件或目录的属性，该函数非常重要
  *
@@ -109,10 +209,15 @@ int newfs_mkdir(const char *path, mode_t mode)
 int newfs_getattr(const char *path, struct stat *nfs_stat)
 {
 	boolean is_find, is_root;
-	struct nfs_dentry *dentry = nfs_lookup(path, &is_find, &is_root);
+	struct nfs_dentry *dentry;
+	struct nfs_inode *inode = NULL;
+
+	NFS_TREE_LOCK();
+	dentry = nfs_lookup(path, &is_find, &is_root);
 	if (is_find == FALSE)
 	{
-		return -NFS_ERROR_NOTFOUND;
+		NFS_TREE_UNLOCK();
+		return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
 	}
 
 	if (NFS_IS_DIR(dentry->inode))
@@ -120,15 +225,21 @@ int newfs_getattr(const char *path, struct stat *nfs_stat)
 		nfs_stat->st_mode = S_IFDIR | NFS_DEFAULT_PERM;
 		nfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct nfs_dentry_d);
 	}
-	else if (NFS_IS_REG(dentry->inode))
+	else
 	{
-		nfs_stat->st_mode = S_IFREG | NFS_DEFAULT_PERM;
-		nfs_stat->st_size = dentry->inode->size;
+		/* 文件大小由inode的rwlock保护，放开树锁后再读 */
+		nfs_stat->st_mode = (NFS_IS_REG(dentry->inode) ? S_IFREG : S_IFLNK) | NFS_DEFAULT_PERM;
+		inode = dentry->inode;
+		nfs_icache_get(inode);
 	}
-	else if (NFS_IS_SYM_LINK(dentry->inode))
+	NFS_TREE_UNLOCK();
+
+	if (inode != NULL)
 	{
-		nfs_stat->st_mode = S_IFLNK | NFS_DEFAULT_PERM;
-		nfs_stat->st_size = dentry->inode->size;
+		pthread_rwlock_rdlock(&inode->rwlock);
+		nfs_stat->st_size = inode->size;
+		pthread_rwlock_unlock(&inode->rwlock);
+		newfs_unref_inode(inode, FALSE);
 	}
 
 	nfs_stat->st_nlink = 1;
@@ -168,34 +279,31 @@ int newfs_getattr(const char *path, struct stat *nfs_stat)
 int newfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
 				  struct fuse_file_info *fi)
 {
-	boolean is_find, is_root;
 	int cur_dir = offset;
+	int ret;
 
-	struct nfs_dentry *dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_dentry *sub_dentry;
-	struct nfs_inode *inode;
-	if (is_find)
+	struct nfs_inode *inode = newfs_get_inode(path, fi, &ret);
+	struct nfs_dirent *dirent;
+	if (inode != NULL)
 	{
-		inode = dentry->inode;
-		sub_dentry = nfs_get_dentry(inode, cur_dir);
-		if (sub_dentry)
+		/* 目录项连续存放，按下标依次填充，直到filler的缓冲区满 */
+		NFS_TREE_LOCK();
+		while ((dirent = nfs_get_dirent(inode, cur_dir)) != NULL)
 		{
-			filler(buf, sub_dentry->fname, NULL, ++offset);
+			if (filler(buf, NFS_DIRENT_NAME(inode, dirent), NULL, ++cur_dir) != 0)
+				break;
 		}
+		NFS_TREE_UNLOCK();
+		newfs_put_inode(inode, fi, FALSE);
 		return NFS_ERROR_NONE;
 	}
-	return -NFS_ERROR_NOTFOUND;
+	return ret;
 }
 
 /**
- * @brief 创建文件
- *
- * @param path 相对于挂载点的路径
- * @param mode 创建文件的模式，可忽略
- * @param dev 设备类型，可忽略
- * @return int 0成功，否则失败
+ * @brief 在树锁下创建文件，rename 也用它建立目标
  */
-int newfs_mknod(const char *path, mode_t mode, dev_t dev)
+static int newfs_do_mknod(const char *path, mode_t mode)
 {
 	boolean is_find, is_root;
 
@@ -204,6 +312,11 @@ int newfs_mknod(const char *path, mode_t mode, dev_t dev)
 	struct nfs_inode *inode;
 	char *fname;
 
+	if (last_dentry == NULL)
+	{
+		return -NFS_ERROR_IO;
+	}
+
 	if (is_find == TRUE)
 	{
 		return -EEXIST;
@@ -226,12 +339,32 @@ int newfs_mknod(const char *path, mode_t mode, dev_t dev)
 	dentry->parent = last_dentry;
 	// ??? 
 	inode = nfs_alloc_inode(dentry);
-	nfs_sync_inode(inode);
+	nfs_mark_inode_dirty(inode);
 	nfs_alloc_dentry(last_dentry->inode, dentry);
+	nfs_mark_inode_dirty(last_dentry->inode);
+	nfs_dcache_invalidate(path);
 
 	return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 创建文件
+ *
+ * @param path 相对于挂载点的路径
+ * @param mode 创建文件的模式，可忽略
+ * @param dev 设备类型，可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_mknod(const char *path, mode_t mode, dev_t dev)
+{
+	int ret;
+
+	NFS_TREE_LOCK();
+	ret = newfs_do_mknod(path, mode);
+	NFS_TREE_UNLOCK();
+	return ret;
+}
+
 /**
  * @brief 修改时间，为了不让touch报错
  *
@@ -247,6 +380,54 @@ int newfs_utimens(const char *path, const struct timespec tv[2])
 /******************************************************************************
  * SECTION: 选做函数实现
  *******************************************************************************/
+/**
+ * @brief 在inode的写锁下写入，只标记inode本身
+ */
+static int newfs_do_write(struct nfs_inode *inode, const char *buf, size_t size, off_t offset)
+{
+	int done, len, blk_idx, blk_ofs;
+
+	if (NFS_IS_DIR(inode))
+	{
+		return -NFS_ERROR_ISDIR;
+	}
+
+	if (inode->size < offset)
+	{
+		return -NFS_ERROR_SEEK;
+	}
+
+	/* 写到已分配范围之外时按需分配数据块 */
+	if (offset + size > NFS_BLKS_SZ(inode->blk_cnt) &&
+		nfs_inode_grow(inode, NFS_ROUND_UP((offset + size), NFS_BLK_SZ()) / NFS_BLK_SZ()) != NFS_ERROR_NONE)
+	{
+		inode->flag |= NFS_FLAG_INODE_DIRTY;
+		return -NFS_ERROR_NOSPACE;
+	}
+
+	if (nfs_load_data(inode, offset, size, TRUE) != NFS_ERROR_NONE)
+	{
+		return -NFS_ERROR_IO;
+	}
+
+	/* 逐块拷贝，并标记写到的数据块 */
+	for (done = 0; done < size; done += len)
+	{
+		blk_idx = (offset + done) / NFS_BLK_SZ();
+		blk_ofs = (offset + done) % NFS_BLK_SZ();
+		len = NFS_BLK_SZ() - blk_ofs < size - done ? NFS_BLK_SZ() - blk_ofs : size - done;
+		memcpy(inode->data[blk_idx] + blk_ofs, buf + done, len);
+		nfs_mark_data_dirty(inode, blk_idx);
+	}
+	if (offset + size > inode->size)
+	{
+		inode->size = offset + size;
+		inode->flag |= NFS_FLAG_INODE_DIRTY;
+	}
+
+	return size;
+}
+
 /**
  * @brief 写入文件
  *
@@ -254,22 +435,33 @@ int newfs_utimens(const char *path, const struct timespec tv[2])
  * @param buf 写入的内容
  * @param size 写入的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 已打开文件的信息，fh 保存inode
  * @return int 写入大小
  */
 int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 				struct fuse_file_info *fi)
 {
-	boolean is_find, is_root;
-	struct nfs_dentry *dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_inode *inode;
+	int ret;
+	struct nfs_inode *inode = newfs_get_inode(path, fi, &ret);
 
-	if (is_find == FALSE)
+	if (inode == NULL)
 	{
-		return -NFS_ERROR_NOTFOUND;
+		return ret;
 	}
 
-	inode = dentry->inode;
+	pthread_rwlock_wrlock(&inode->rwlock);
+	ret = newfs_do_write(inode, buf, size, offset);
+	pthread_rwlock_unlock(&inode->rwlock);
+	newfs_put_inode(inode, fi, TRUE);
+	return ret;
+}
+
+/**
+ * @brief 在inode的锁下读取，调用者已保证需要的块都已调入或持有写锁
+ */
+static int newfs_do_read(struct nfs_inode *inode, char *buf, size_t size, off_t offset)
+{
+	int done, len, blk_idx, blk_ofs;
 
 	if (NFS_IS_DIR(inode))
 	{
@@ -281,8 +473,23 @@ int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 		return -NFS_ERROR_SEEK;
 	}
 
-	memcpy(inode->data + offset, buf, size);
-	inode->size = offset + size > inode->size ? offset + size : inode->size;
+	if (offset + size > inode->size)
+	{
+		size = inode->size - offset;
+	}
+
+	if (nfs_load_data(inode, offset, size, FALSE) != NFS_ERROR_NONE)
+	{
+		return -NFS_ERROR_IO;
+	}
+
+	for (done = 0; done < size; done += len)
+	{
+		blk_idx = (offset + done) / NFS_BLK_SZ();
+		blk_ofs = (offset + done) % NFS_BLK_SZ();
+		len = NFS_BLK_SZ() - blk_ofs < size - done ? NFS_BLK_SZ() - blk_ofs : size - done;
+		memcpy(buf + done, inode->data[blk_idx] + blk_ofs, len);
+	}
 
 	return size;
 }
@@ -290,40 +497,80 @@ int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 /**
  * @brief 读取文件
  *
+ * 数据都已调入时只持有读锁，同一文件可以并发读；需要调入时换成写锁
+ *
  * @param path 相对于挂载点的路径
  * @param buf 读取的内容
  * @param size 读取的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 已打开文件的信息，fh 保存inode
  * @return int 读取大小
  */
 int newfs_read(const char *path, char *buf, size_t size, off_t offset,
 			   struct fuse_file_info *fi)
+{
+	int ret;
+	struct nfs_inode *inode = newfs_get_inode(path, fi, &ret);
+
+	if (inode == NULL)
+	{
+		return ret;
+	}
+
+	pthread_rwlock_rdlock(&inode->rwlock);
+	if (!nfs_data_loaded(inode, offset, size))
+	{
+		pthread_rwlock_unlock(&inode->rwlock);
+		pthread_rwlock_wrlock(&inode->rwlock);
+	}
+	ret = newfs_do_read(inode, buf, size, offset);
+	pthread_rwlock_unlock(&inode->rwlock);
+	newfs_put_inode(inode, fi, FALSE);
+	return ret;
+}
+
+/**
+ * @brief 在树锁下删除文件或目录
+ */
+static int newfs_do_unlink(const char *path)
 {
 	boolean is_find, is_root;
+	boolean is_orphan;
 	struct nfs_dentry *dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode *inode;
 
 	if (is_find == FALSE)
 	{
-		return -NFS_ERROR_NOTFOUND;
+		return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
 	}
 
 	inode = dentry->inode;
 
-	if (NFS_IS_DIR(inode))
+	/* 仍被打开时只从目录树摘除，等最后一次release再释放inode */
+	is_orphan = inode->ref_cnt > 0;
+	if (is_orphan)
 	{
-		return -NFS_ERROR_ISDIR;
+		pthread_rwlock_wrlock(&inode->rwlock);
+		inode->flag |= NFS_FLAG_INODE_ORPHAN;
+		pthread_rwlock_unlock(&inode->rwlock);
 	}
-
-	if (inode->size < offset)
+	else if (nfs_drop_inode(inode) != NFS_ERROR_NONE)
 	{
-		return -NFS_ERROR_SEEK;
+		return -NFS_ERROR_IO;
 	}
-
-	memcpy(buf, inode->data + offset, size);
-
-	return size;
+	nfs_drop_dentry(dentry->parent->inode, dentry);
+	nfs_mark_inode_dirty(dentry->parent->inode);
+	nfs_dcache_invalidate(path);
+	/* 父目录随后可能被删除，孤儿inode不能再记在它名下，它的dentry留到最后一次release */
+	if (is_orphan)
+	{
+		nfs_icache_orphan(inode);
+	}
+	else
+	{
+		nfs_slab_free(NFS_SLAB_DENTRY(), dentry);
+	}
+	return NFS_ERROR_NONE;
 }
 
 /**
@@ -334,20 +581,12 @@ int newfs_read(const char *path, char *buf, size_t size, off_t offset,
  */
 int newfs_unlink(const char *path)
 {
-	boolean is_find, is_root;
-	struct nfs_dentry *dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_inode *inode;
-
-	if (is_find == FALSE)
-	{
-		return -NFS_ERROR_NOTFOUND;
-	}
-
-	inode = dentry->inode;
+	int ret;
 
-	nfs_drop_inode(inode);
-	nfs_drop_dentry(dentry->parent->inode, dentry);
-	return NFS_ERROR_NONE;
+	NFS_TREE_LOCK();
+	ret = newfs_do_unlink(path);
+	NFS_TREE_UNLOCK();
+	return ret;
 }
 
 /**
@@ -368,23 +607,21 @@ int newfs_rmdir(const char *path)
 }
 
 /**
- * @brief 重命名文件
- *
- * @param from 源文件路径
- * @param to 目标文件路径
- * @return int 0成功，否则失败
+ * @brief 在树锁下重命名
  */
-int newfs_rename(const char *from, const char *to)
+static int newfs_do_rename(const char *from, const char *to)
 {
 	int ret = NFS_ERROR_NONE;
 	boolean is_find, is_root;
 	struct nfs_dentry *from_dentry = nfs_lookup(from, &is_find, &is_root);
 	struct nfs_inode *from_inode;
 	struct nfs_dentry *to_dentry;
+	struct nfs_dentry *sub_dentry;
 	mode_t mode = 0;
+	int i;
 	if (is_find == FALSE)
 	{
-		return -NFS_ERROR_NOTFOUND;
+		return from_dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
 	}
 
 	if (strcmp(from, to) == 0)
@@ -403,18 +640,66 @@ int newfs_rename(const char *from, const char *to)
 		mode = S_IFREG;
 	}
 
-	ret = newfs_mknod(to, mode, 0);
+	/* 下面还要查找两次，期间不能被淘汰 */
+	nfs_icache_get(from_inode);
+	ret = newfs_do_mknod(to, mode);
 	if (ret != NFS_ERROR_NONE)
 	{ /* 保证目的文件不存在 */
+		nfs_icache_put(from_inode);
 		return ret;
 	}
 
 	to_dentry = nfs_lookup(to, &is_find, &is_root);
+	nfs_icache_put(from_inode);
+	if (to_dentry == NULL)
+	{
+		return -NFS_ERROR_IO;
+	}
 	nfs_drop_inode(to_dentry->inode); /* 保证生成的inode被释放 */
 	to_dentry->ino = from_inode->ino; /* 指向新的inode */
 	to_dentry->inode = from_inode;
+	nfs_dir_update(to_dentry->parent->inode, to_dentry);
+	if (NFS_IS_DIR(from_inode))
+	{ /* 子目录项的父亲随之改变 */
+		nfs_icache_move(from_inode, to_dentry);
+		for (i = 0; i < from_inode->dir_cnt; i++)
+		{
+			sub_dentry = from_inode->dirents[i].dentry;
+			if (sub_dentry != NULL)
+				sub_dentry->parent = to_dentry;
+		}
+	}
+	else
+	{ /* 已打开的文件在读写时会访问 inode->dentry */
+		pthread_rwlock_wrlock(&from_inode->rwlock);
+		nfs_icache_move(from_inode, to_dentry);
+		pthread_rwlock_unlock(&from_inode->rwlock);
+	}
 
 	nfs_drop_dentry(from_dentry->parent->inode, from_dentry);
+	nfs_mark_inode_dirty(from_dentry->parent->inode);
+	nfs_mark_inode_dirty(to_dentry->parent->inode);
+	nfs_dcache_invalidate(from);
+	nfs_dcache_invalidate(to);
+	/* inode已挂到to_dentry下，原来的dentry不再被引用 */
+	nfs_slab_free(NFS_SLAB_DENTRY(), from_dentry);
+	return ret;
+}
+
+/**
+ * @brief 重命名文件
+ *
+ * @param from 源文件路径
+ * @param to 目标文件路径
+ * @return int 0成功，否则失败
+ */
+int newfs_rename(const char *from, const char *to)
+{
+	int ret;
+
+	NFS_TREE_LOCK();
+	ret = newfs_do_rename(from, to);
+	NFS_TREE_UNLOCK();
 	return ret;
 }
 
@@ -422,12 +707,24 @@ int newfs_rename(const char *from, const char *to)
  * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
  * 保存在fh中
  *
+ * 这里把查找到的inode保存在fh中并增加引用计数，之后的read/write不再重复解析路径
+ *
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则失败
  */
 int newfs_open(const char *path, struct fuse_file_info *fi)
 {
+	/* 按路径取得时增加的引用计数即为 fh 持有的引用 */
+	int ret;
+	struct nfs_inode *inode = newfs_get_inode(path, NULL, &ret);
+
+	if (inode == NULL)
+	{
+		return ret;
+	}
+
+	fi->fh = (uint64_t)(uintptr_t)inode;
 	return NFS_ERROR_NONE;
 }
 
@@ -440,36 +737,172 @@ int newfs_open(const char *path, struct fuse_file_info *fi)
  */
 int newfs_opendir(const char *path, struct fuse_file_info *fi)
 {
-	return NFS_ERROR_NONE;
+	return newfs_open(path, fi);
 }
 
 /**
- * @brief 改变文件大小
+ * @brief 关闭文件，减少引用计数；已被删除的文件在最后一次关闭时释放
  *
- * @param path 相对于挂载点的路径
- * @param offset 改变后文件大小
+ * @param path 相对于挂载点的路径，文件已被删除时可能为NULL
+ * @param fi 文件信息
  * @return int 0成功，否则失败
  */
-int newfs_truncate(const char *path, off_t offset)
+int newfs_release(const char *path, struct fuse_file_info *fi)
 {
-	boolean is_find, is_root;
-	struct nfs_dentry *dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_inode *inode;
+	struct nfs_inode *inode = (struct nfs_inode *)(uintptr_t)fi->fh;
 
-	if (is_find == FALSE)
+	if (inode == NULL)
 	{
-		return -NFS_ERROR_NOTFOUND;
+		return NFS_ERROR_NONE;
 	}
 
-	inode = dentry->inode;
+	fi->fh = 0;
+	/* 通过 fh 写入的文件在这里补上祖先的脏标记 */
+	newfs_unref_inode(inode, (fi->flags & O_ACCMODE) != O_RDONLY);
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭目录文件
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	return newfs_release(path, fi);
+}
+
+/**
+ * @brief 在inode的写锁下改变文件大小
+ */
+static int newfs_do_truncate(struct nfs_inode *inode, off_t offset)
+{
+	int blk_cnt;
 
 	if (NFS_IS_DIR(inode))
 	{
 		return -NFS_ERROR_ISDIR;
 	}
 
+	blk_cnt = NFS_ROUND_UP(offset, NFS_BLK_SZ()) / NFS_BLK_SZ();
+	if (offset > inode->size)
+	{
+		if (nfs_inode_grow(inode, blk_cnt) != NFS_ERROR_NONE)
+		{
+			inode->flag |= NFS_FLAG_INODE_DIRTY;
+			return -NFS_ERROR_NOSPACE;
+		}
+	}
+	else
+	{
+		nfs_inode_shrink(inode, blk_cnt);
+		/* 截断处之后的旧内容清零，之后再扩大时读到的是0 */
+		if (offset % NFS_BLK_SZ() != 0)
+		{
+			if (nfs_load_data(inode, offset, 1, FALSE) != NFS_ERROR_NONE)
+			{
+				return -NFS_ERROR_IO;
+			}
+			memset(inode->data[blk_cnt - 1] + offset % NFS_BLK_SZ(), 0,
+				   NFS_BLK_SZ() - offset % NFS_BLK_SZ());
+			nfs_mark_data_dirty(inode, blk_cnt - 1);
+		}
+	}
+
 	inode->size = offset;
+	inode->flag |= NFS_FLAG_INODE_DIRTY;
+
+	return NFS_ERROR_NONE;
+}
+
+static int newfs_truncate_inode(const char *path, off_t offset, struct fuse_file_info *fi)
+{
+	int ret;
+	struct nfs_inode *inode = newfs_get_inode(path, fi, &ret);
+
+	if (inode == NULL)
+	{
+		return ret;
+	}
+
+	pthread_rwlock_wrlock(&inode->rwlock);
+	ret = newfs_do_truncate(inode, offset);
+	pthread_rwlock_unlock(&inode->rwlock);
+	newfs_put_inode(inode, fi, TRUE);
+	return ret;
+}
+
+/**
+ * @brief 改变文件大小
+ *
+ * @param path 相对于挂载点的路径
+ * @param offset 改变后文件大小
+ * @return int 0成功，否则失败
+ */
+int newfs_truncate(const char *path, off_t offset)
+{
+	return newfs_truncate_inode(path, offset, NULL);
+}
 
+/**
+ * @brief 改变已打开文件的大小（open时带O_TRUNC等）
+ *
+ * @param path 相对于挂载点的路径
+ * @param offset 改变后文件大小
+ * @param fi 已打开文件的信息，fh 保存inode
+ * @return int 0成功，否则失败
+ */
+int newfs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi)
+{
+	return newfs_truncate_inode(path, offset, fi);
+}
+
+/**
+ * @brief 同步文件，将inode刷入块缓存后回写全部脏块
+ *
+ * @param path 相对于挂载点的路径
+ * @param datasync 可忽略
+ * @param fi 可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	int ret = NFS_ERROR_NONE;
+	struct nfs_inode *inode = newfs_get_inode(path, fi, &ret);
+	boolean is_dir;
+
+	if (inode == NULL)
+	{
+		return ret;
+	}
+
+	/* 目录连同其下的inode在树锁下回写，普通文件只需自己的写锁 */
+	NFS_TREE_LOCK();
+	is_dir = NFS_IS_DIR(inode);
+	if (is_dir)
+	{
+		ret = nfs_sync_inode(inode);
+	}
+	NFS_TREE_UNLOCK();
+	if (!is_dir)
+	{
+		pthread_rwlock_wrlock(&inode->rwlock);
+		ret = nfs_sync_inode(inode);
+		pthread_rwlock_unlock(&inode->rwlock);
+	}
+	newfs_put_inode(inode, fi, FALSE);
+
+	if (ret != NFS_ERROR_NONE || nfs_cache_sync() != NFS_ERROR_NONE)
+	{
+		return -NFS_ERROR_IO;
+	}
+	/* 块缓存写到驱动后，再让驱动把数据落到磁盘镜像 */
+	if (ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_FLUSH, NULL) < 0)
+	{
+		return -NFS_ERROR_IO;
+	}
 	return NFS_ERROR_NONE;
 }
 
@@ -489,7 +922,14 @@ int newfs_access(const char *path, int type)
 {
 	boolean is_find, is_root;
 	boolean is_access_ok = FALSE;
-	nfs_lookup(path, &is_find, &is_root);
+	struct nfs_dentry *dentry;
+	NFS_TREE_LOCK();
+	dentry = nfs_lookup(path, &is_find, &is_root);
+	NFS_TREE_UNLOCK();
+	if (dentry == NULL)
+	{
+		return -NFS_ERROR_IO;
+	}
 
 	switch (type)
 	{
@@ -522,6 +962,7 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	nfs_options.device = strdup("/home/students/200111223/ddriver");
+	nfs_options.inode_cache_mb = NFS_ICACHE_MB;
 	if (fuse_opt_parse(&args, &nfs_options, option_spec, NULL) == -1)
 		return -1;
 	ret = fuse_main(args.argc, args.argv, &operations, NULL);
@@ -0,0 +1,117 @@
+#include "../include/newfs.h"
+
+/**
+ * slab 分配器
+ *
+ * dentry、inode、数据块缓冲这类定长对象从按 NFS_SLAB_CHUNK_SZ 批量申请的
+ * chunk 中切分，释放的对象挂回空闲链表供下次复用，不再逐个 malloc/free。
+ * chunk 只在卸载时整体释放。多个FUSE线程共用同一个slab，申请和释放在 slab->lock 下进行。
+ */
+#define NFS_SLAB_HDR_SZ                 NFS_ROUND_UP((int)sizeof(struct nfs_slab_chunk), NFS_SLAB_ALIGN)
+
+/**
+ * @brief 初始化一个对象大小为 obj_sz 的slab
+ */
+void nfs_slab_init(struct nfs_slab *slab, const char *name, int obj_sz)
+{
+    memset(slab, 0, sizeof(struct nfs_slab));
+    if (obj_sz < (int)sizeof(void *))
+        obj_sz = sizeof(void *);
+    slab->name = name;
+    slab->obj_sz = NFS_ROUND_UP(obj_sz, NFS_SLAB_ALIGN);
+    slab->per_chunk = (NFS_SLAB_CHUNK_SZ - NFS_SLAB_HDR_SZ) / slab->obj_sz;
+    if (slab->per_chunk < 1)
+        slab->per_chunk = 1;
+    pthread_mutex_init(&slab->lock, NULL);
+}
+
+/**
+ * @brief 申请一个新chunk并把其中的对象全部挂入空闲链表
+ */
+static int nfs_slab_grow(struct nfs_slab *slab)
+{
+    struct nfs_slab_chunk *chunk;
+    uint8_t *obj;
+    int i;
+
+    chunk = (struct nfs_slab_chunk *)malloc(NFS_SLAB_HDR_SZ + slab->per_chunk * slab->obj_sz);
+    if (chunk == NULL)
+        return -NFS_ERROR_NOSPACE;
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    slab->chunk_cnt++;
+
+    obj = (uint8_t *)chunk + NFS_SLAB_HDR_SZ;
+    for (i = slab->per_chunk - 1; i >= 0; i--)
+    {
+        *(void **)(obj + i * slab->obj_sz) = slab->free_list;
+        slab->free_list = obj + i * slab->obj_sz;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @return void* 内容未初始化，失败返回NULL
+ */
+void *nfs_slab_alloc(struct nfs_slab *slab)
+{
+    void *obj;
+
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list == NULL && nfs_slab_grow(slab) != NFS_ERROR_NONE)
+    {
+        pthread_mutex_unlock(&slab->lock);
+        return NULL;
+    }
+    obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    slab->alloc_cnt++;
+    if (++slab->in_use > slab->peak)
+        slab->peak = slab->in_use;
+    pthread_mutex_unlock(&slab->lock);
+    return obj;
+}
+
+/**
+ * @return void* 内容清零，失败返回NULL
+ */
+void *nfs_slab_zalloc(struct nfs_slab *slab)
+{
+    void *obj = nfs_slab_alloc(slab);
+
+    if (obj != NULL)
+        memset(obj, 0, slab->obj_sz);
+    return obj;
+}
+
+void nfs_slab_free(struct nfs_slab *slab, void *obj)
+{
+    if (obj == NULL)
+        return;
+    pthread_mutex_lock(&slab->lock);
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+/**
+ * @brief 释放全部chunk，其中的对象一并失效，卸载时调用
+ */
+void nfs_slab_destroy(struct nfs_slab *slab)
+{
+    struct nfs_slab_chunk *chunk;
+
+    NFS_DBG("slab %s: obj %d B, in use: %d, peak: %d, allocs: %ld, chunks: %d\n",
+            slab->name, slab->obj_sz, slab->in_use, slab->peak, slab->alloc_cnt,
+            slab->chunk_cnt);
+    while (slab->chunks != NULL)
+    {
+        chunk = slab->chunks;
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    slab->free_list = NULL;
+    slab->chunk_cnt = 0;
+    pthread_mutex_destroy(&slab->lock);
+}
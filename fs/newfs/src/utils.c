@@ -41,105 +41,329 @@ int nfs_calc_lvl(const char *path)
 /**
  * 驱动读
  *
- * BLK_SZ = 2 * IO_SIZE
+ * BLK_SZ = 2 * IO_SIZE，经过块缓存，未命中的块才真正访问驱动
  */
 int nfs_driver_read(int start, uint8_t *out_content, int size)
 {
-    // 对齐的时候按 BLK_SZ
-    int start_aligned = NFS_ROUND_DOWN(start, NFS_BLK_SZ());
-    int bias = start - start_aligned;
-    int size_aligned = NFS_ROUND_UP((size + bias), NFS_BLK_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
+    return nfs_cache_read(start, out_content, size);
+}
 
-    // 驱动读的时候按 IO_SZ
-    ddriver_seek(NFS_DRIVER(), start_aligned, SEEK_SET);
-    while (size_aligned != 0)
+// 驱动写，只写入块缓存并置脏，淘汰 / fsync / umount 时回写
+int nfs_driver_write(int dst, uint8_t *in_content, int size)
+{
+    return nfs_cache_write(dst, in_content, size);
+}
+
+/**
+ * @brief 文件名/路径哈希 (FNV-1a)
+ */
+uint32_t nfs_hash_fname(const char *fname)
+{
+    uint32_t hash = 2166136261u;
+    while (*fname)
     {
-        ddriver_read(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
+        hash ^= (uint8_t)*fname++;
+        hash *= 16777619u;
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
-    return NFS_ERROR_NONE;
+    return hash;
 }
 
-// 驱动写
-int nfs_driver_write(int dst, uint8_t *in_content, int size)
+/**
+ * @brief 从slab分配一个dentry
+ */
+struct nfs_dentry *new_dentry(const char *fname, NFS_FILE_TYPE ftype)
+{
+    struct nfs_dentry *dentry = (struct nfs_dentry *)nfs_slab_zalloc(NFS_SLAB_DENTRY());
+    NFS_ASSIGN_FNAME(dentry, fname);
+    dentry->ftype = ftype;
+    dentry->ino = -1;
+    return dentry;
+}
+
+/**
+ * 目录项
+ *
+ * 目录inode用 dirents 数组连续存放全部目录项记录（哈希、文件名偏移、ino、类型），
+ * 文件名集中放在 names 区中，以'\0'结尾。按文件名查找走 dir_index 开放寻址表，
+ * 只有查找命中的目录项才建立完整的 struct nfs_dentry，挂在记录的 dentry 上。
+ * 删除时用最后一项填补空位，文件名区中留下的空洞超过一半时整理一次。
+ */
+static void nfs_dir_index_insert(struct nfs_inode *inode, int idx)
+{
+    int mask = inode->index_sz - 1;
+    int slot = inode->dirents[idx].hash & mask;
+
+    while (inode->dir_index[slot] >= 0)
+        slot = (slot + 1) & mask;
+    inode->dir_index[slot] = idx;
+}
+
+/**
+ * @brief (重新)建立目录索引，表长为2的幂且至少是目录项数的2倍
+ */
+static void nfs_dir_index_build(struct nfs_inode *inode)
 {
-    // 对齐的时候按 BLK_SZ
-    int dst_aligned = NFS_ROUND_DOWN(dst, NFS_BLK_SZ());
-    int bias = dst - dst_aligned;
-    int size_aligned = NFS_ROUND_UP((size + bias), NFS_BLK_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    nfs_driver_read(dst_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
+    int index_sz = NFS_DIR_HASH_INIT;
+    int i;
 
-    // 驱动写的时候按 IO_SZ
-    ddriver_seek(NFS_DRIVER(), dst_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    while (index_sz < 2 * (inode->dir_cnt + 1))
+        index_sz *= 2;
+    free(inode->dir_index);
+    inode->dir_index = (int *)malloc(index_sz * sizeof(int));
+    memset(inode->dir_index, 0xff, index_sz * sizeof(int));
+    inode->index_sz = index_sz;
+    for (i = 0; i < inode->dir_cnt; i++)
+        nfs_dir_index_insert(inode, i);
+}
+
+/**
+ * @brief 删除索引中 slot 处的项，把后面同一探测链上的项前移，保持查找不断链
+ */
+static void nfs_dir_index_remove(struct nfs_inode *inode, int slot)
+{
+    int mask = inode->index_sz - 1;
+    int hole = slot;
+    int cursor, home;
+
+    for (cursor = (hole + 1) & mask; inode->dir_index[cursor] >= 0; cursor = (cursor + 1) & mask)
     {
-        ddriver_write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
+        home = inode->dirents[inode->dir_index[cursor]].hash & mask;
+        /* home 不在 (hole, cursor] 之间的项可以前移到 hole */
+        if (hole <= cursor ? (home <= hole || home > cursor) : (home <= hole && home > cursor))
+        {
+            inode->dir_index[hole] = inode->dir_index[cursor];
+            hole = cursor;
+        }
     }
+    inode->dir_index[hole] = -1;
+}
 
-    free(temp_content);
-    return NFS_ERROR_NONE;
+/**
+ * @return int 记录下标，没有返回-1；slot 返回它在索引中的位置
+ */
+static int nfs_dir_find(struct nfs_inode *inode, const char *fname, int len, uint32_t hash,
+                        int *slot)
+{
+    struct nfs_dirent *dirent;
+    int mask, cursor;
+
+    if (inode->dir_index == NULL)
+        nfs_dir_index_build(inode);
+    mask = inode->index_sz - 1;
+    for (cursor = hash & mask; inode->dir_index[cursor] >= 0; cursor = (cursor + 1) & mask)
+    {
+        dirent = &inode->dirents[inode->dir_index[cursor]];
+        if (dirent->hash == hash && dirent->name_len == len &&
+            memcmp(NFS_DIRENT_NAME(inode, dirent), fname, len) == 0)
+        {
+            if (slot != NULL)
+                *slot = cursor;
+            return inode->dir_index[cursor];
+        }
+    }
+    return -1;
 }
 
-// 为一个inode分配dentry，采用头插法
-int nfs_alloc_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
+/**
+ * @brief 丢掉文件名区中已删除目录项留下的空洞
+ */
+static void nfs_dir_compact_names(struct nfs_inode *inode)
 {
-    if (inode->dentrys == NULL)
+    char *names = (char *)malloc(inode->names_cap);
+    int len = 0;
+    int i;
+
+    for (i = 0; i < inode->dir_cnt; i++)
     {
-        inode->dentrys = dentry;
+        memcpy(names + len, NFS_DIRENT_NAME(inode, &inode->dirents[i]),
+               inode->dirents[i].name_len + 1);
+        inode->dirents[i].name_off = len;
+        len += inode->dirents[i].name_len + 1;
     }
-    else
+    free(inode->names);
+    inode->names = names;
+    inode->names_len = len;
+    inode->names_dead = 0;
+}
+
+/**
+ * @brief 在目录末尾追加一条目录项记录，不建立dentry
+ *
+ * @return int 记录下标，内存不足返回-NFS_ERROR_NOSPACE
+ */
+int nfs_dir_append(struct nfs_inode *inode, const char *fname, int ino, NFS_FILE_TYPE ftype)
+{
+    struct nfs_dirent *dirent;
+    int len = strnlen(fname, NFS_MAX_FILE_NAME);
+    int cap;
+    void *grown;
+
+    if (inode->dir_cnt == inode->dirent_cap)
+    {
+        cap = inode->dirent_cap ? inode->dirent_cap * 2 : NFS_DIR_HASH_INIT;
+        grown = realloc(inode->dirents, cap * sizeof(struct nfs_dirent));
+        if (grown == NULL)
+            return -NFS_ERROR_NOSPACE;
+        inode->dirents = (struct nfs_dirent *)grown;
+        inode->dirent_cap = cap;
+    }
+    if (inode->names_len + len + 1 > inode->names_cap)
     {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+        cap = inode->names_cap ? inode->names_cap : NFS_MAX_FILE_NAME;
+        while (cap < inode->names_len + len + 1)
+            cap *= 2;
+        grown = realloc(inode->names, cap);
+        if (grown == NULL)
+            return -NFS_ERROR_NOSPACE;
+        inode->names = (char *)grown;
+        inode->names_cap = cap;
     }
+
+    dirent = &inode->dirents[inode->dir_cnt];
+    dirent->hash = nfs_hash_fname(fname);
+    dirent->ino = ino;
+    dirent->name_off = inode->names_len;
+    dirent->name_len = len;
+    dirent->ftype = ftype;
+    dirent->dentry = NULL;
+    memcpy(inode->names + inode->names_len, fname, len);
+    inode->names[inode->names_len + len] = '\0';
+    inode->names_len += len + 1;
     inode->dir_cnt++;
-    return inode->dir_cnt;
+    nfs_icache_charge(inode, sizeof(struct nfs_dirent) + len + 1);
+
+    if (inode->dir_index != NULL)
+    {
+        if (2 * inode->dir_cnt > inode->index_sz)
+            nfs_dir_index_build(inode);
+        else
+            nfs_dir_index_insert(inode, inode->dir_cnt - 1);
+    }
+    return inode->dir_cnt - 1;
 }
 
-// 将dentry从inode的dentrys中取出
-int nfs_drop_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
+/**
+ * @brief 取得第 idx 条记录对应的dentry，没有则建立
+ */
+struct nfs_dentry *nfs_dir_dentry(struct nfs_inode *inode, int idx)
 {
-    boolean is_find = FALSE;
-    struct nfs_dentry *dentry_cursor;
-    dentry_cursor = inode->dentrys;
+    struct nfs_dirent *dirent = &inode->dirents[idx];
+    struct nfs_dentry *dentry = dirent->dentry;
 
-    if (dentry_cursor == dentry)
+    if (dentry == NULL)
     {
-        inode->dentrys = dentry->brother;
-        is_find = TRUE;
+        dentry = new_dentry(NFS_DIRENT_NAME(inode, dirent), dirent->ftype);
+        dentry->parent = inode->dentry;
+        dentry->ino = dirent->ino;
+        dirent->dentry = dentry;
+        nfs_icache_charge(inode, sizeof(struct nfs_dentry));
     }
-    else
+    return dentry;
+}
+
+/**
+ * @brief 释放目录项上已建立的dentry，只保留记录。dentry不能再被引用
+ */
+void nfs_dir_release_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    int idx = nfs_dir_find(inode, dentry->fname, strlen(dentry->fname),
+                           nfs_hash_fname(dentry->fname), NULL);
+
+    if (idx >= 0 && inode->dirents[idx].dentry == dentry)
     {
-        while (dentry_cursor)
-        {
-            if (dentry_cursor->brother == dentry)
-            {
-                dentry_cursor->brother = dentry->brother;
-                is_find = TRUE;
-                break;
-            }
-            dentry_cursor = dentry_cursor->brother;
-        }
+        inode->dirents[idx].dentry = NULL;
+        nfs_icache_charge(inode, -(long)sizeof(struct nfs_dentry));
+        nfs_slab_free(NFS_SLAB_DENTRY(), dentry);
     }
-    if (!is_find)
+}
+
+/**
+ * @brief dentry指向的inode改变后（rename），同步修改它的记录
+ */
+void nfs_dir_update(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    int idx = nfs_dir_find(inode, dentry->fname, strlen(dentry->fname),
+                           nfs_hash_fname(dentry->fname), NULL);
+
+    if (idx >= 0)
+    {
+        inode->dirents[idx].ino = dentry->ino;
+        inode->dirents[idx].ftype = dentry->ftype;
+    }
+}
+
+/**
+ * @brief 释放目录全部记录及已建立的dentry
+ */
+void nfs_dir_free(struct nfs_inode *inode)
+{
+    int i;
+
+    for (i = 0; i < inode->dir_cnt; i++)
+        nfs_slab_free(NFS_SLAB_DENTRY(), inode->dirents[i].dentry);
+    free(inode->dirents);
+    free(inode->names);
+    free(inode->dir_index);
+    inode->dirents = NULL;
+    inode->names = NULL;
+    inode->dir_index = NULL;
+    inode->dir_cnt = 0;
+}
+
+/**
+ * @brief 在目录inode中按完整文件名查找目录项
+ */
+struct nfs_dentry *nfs_find_dentry(struct nfs_inode *inode, const char *fname)
+{
+    int idx = nfs_dir_find(inode, fname, strlen(fname), nfs_hash_fname(fname), NULL);
+    return idx >= 0 ? nfs_dir_dentry(inode, idx) : NULL;
+}
+
+// 为一个inode分配dentry，追加在目录末尾
+int nfs_alloc_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    int idx = nfs_dir_append(inode, dentry->fname, dentry->ino, dentry->ftype);
+
+    if (idx < 0)
+        return idx;
+    inode->dirents[idx].dentry = dentry;
+    nfs_icache_charge(inode, sizeof(struct nfs_dentry));
+    return inode->dir_cnt;
+}
+
+// 将dentry从inode的目录项中取出，dentry本身由调用者处理
+int nfs_drop_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    int len = strlen(dentry->fname);
+    int last = inode->dir_cnt - 1;
+    int idx, slot;
+
+    idx = nfs_dir_find(inode, dentry->fname, len, nfs_hash_fname(dentry->fname), &slot);
+    if (idx < 0)
     {
         return -NFS_ERROR_NOTFOUND;
     }
+    nfs_dir_index_remove(inode, slot);
+    if (inode->dirents[idx].dentry != NULL)
+        nfs_icache_charge(inode, -(long)sizeof(struct nfs_dentry));
+    nfs_icache_charge(inode, -(long)(sizeof(struct nfs_dirent) + len + 1));
+    inode->names_dead += len + 1;
+
+    /* 最后一项移到空位，索引中指向它的位置随之修改 */
+    if (idx != last)
+    {
+        inode->dirents[idx] = inode->dirents[last];
+        nfs_dir_find(inode, NFS_DIRENT_NAME(inode, &inode->dirents[idx]),
+                     inode->dirents[idx].name_len, inode->dirents[idx].hash, &slot);
+        inode->dir_index[slot] = idx;
+    }
     inode->dir_cnt--;
+    if (inode->names_dead > inode->names_len / 2)
+        nfs_dir_compact_names(inode);
     return inode->dir_cnt;
 }
 /**
- * @brief 分配一个inode，占用位图
+ * @brief 分配一个inode，占用位图。数据块不预先分配，写入时按需分配
  *
  * @param dentry 该dentry指向分配的inode
  * @return nfs_inode
@@ -147,175 +371,681 @@ int nfs_drop_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
 struct nfs_inode *nfs_alloc_inode(struct nfs_dentry *dentry)
 {
     struct nfs_inode *inode;
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    boolean is_find_free_entry = FALSE;
+    int ino_cursor;
 
-    printf("before alloc inode=======================\n");
-    nfs_dump_map_inode();
-    // 从 inode 位图里找空闲
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks); byte_cursor++)
+    NFS_ALLOC_LOCK();
+    // 从 inode 位图里找空闲，从上次分配的位置往后找
+    ino_cursor = nfs_bitmap_find_zero(nfs_super.map_inode, nfs_super.num_ino, nfs_super.ino_hint);
+    if (ino_cursor < 0)
+    {
+        NFS_ALLOC_UNLOCK();
+        return -NFS_ERROR_NOSPACE;
+    }
+    nfs_bitmap_set(nfs_super.map_inode, ino_cursor);
+    nfs_super.ino_hint = ino_cursor + 1;
+    NFS_ALLOC_UNLOCK();
+
+    inode = (struct nfs_inode *)nfs_slab_alloc(NFS_SLAB_INODE());
+    inode->ino = ino_cursor;
+    inode->size = 0;
+    inode->blk_cnt = 0;
+    inode->extent_cnt = 0;
+    inode->extent_cap = 0;
+    inode->extents = NULL;
+    inode->ind_blk = -1;
+    inode->dind_blk = -1;
+    inode->dind_blks = NULL;
+    inode->dind_cnt = 0;
+    inode->bmap_ext = 0;
+    inode->bmap_base = 0;
+
+    /* dentry指向inode */
+    dentry->inode = inode;
+    dentry->ino = inode->ino;
+    /* inode指回dentry */
+    inode->dentry = dentry;
+
+    inode->dir_cnt = 0;
+    inode->dirents = NULL;
+    inode->dirent_cap = 0;
+    inode->names = NULL;
+    inode->names_len = 0;
+    inode->names_cap = 0;
+    inode->names_dead = 0;
+    inode->dir_index = NULL;
+    inode->index_sz = 0;
+    inode->flag = 0;
+    inode->data = NULL;
+    inode->data_cap = 0;
+    inode->data_dirty = NULL;
+    inode->data_resident = NULL;
+    inode->ref_cnt = 0;
+    inode->child_cnt = 0;
+    inode->mem = 0;
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+    pthread_rwlock_init(&inode->rwlock, NULL);
+    nfs_icache_add(inode);
+
+    return inode;
+}
+/**
+ * @brief 在 data 位图中分配一段连续空闲块，优先从 goal 开始，使文件尽量连续
+ *
+ * @param goal 期望的起始块号，-1表示不指定
+ * @param want 最多分配的块数
+ * @param start 返回起始块号
+ * @return int 实际分配的块数，没有空闲块返回-NFS_ERROR_NOSPACE
+ */
+static int nfs_alloc_run(int goal, int want, int *start)
+{
+    int blk;
+    int len = 0;
+
+    NFS_ALLOC_LOCK();
+    if (goal >= 0 && goal < nfs_super.num_data && !nfs_bitmap_test(nfs_super.map_data, goal))
+        blk = goal;
+    else
+        blk = nfs_bitmap_find_zero(nfs_super.map_data, nfs_super.num_data, nfs_super.data_hint);
+    if (blk < 0)
+    {
+        NFS_ALLOC_UNLOCK();
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    while (len < want && blk + len < nfs_super.num_data &&
+           !nfs_bitmap_test(nfs_super.map_data, blk + len))
+    {
+        nfs_bitmap_set(nfs_super.map_data, blk + len);
+        len++;
+    }
+    nfs_super.data_hint = blk + len;
+    NFS_ALLOC_UNLOCK();
+    *start = blk;
+    return len;
+}
+/**
+ * @brief 扩大data / data_dirty / data_resident，使其至少容纳 blk_cnt 块
+ */
+static int nfs_data_reserve(struct nfs_inode *inode, int blk_cnt)
+{
+    int cap = inode->data_cap ? inode->data_cap : 4;
+    int old_bytes = NFS_ROUND_UP(inode->data_cap, UINT8_BITS) / UINT8_BITS;
+    int new_bytes;
+    uint8_t **data;
+    uint8_t *dirty;
+    uint8_t *resident;
+
+    if (blk_cnt <= inode->data_cap)
+        return NFS_ERROR_NONE;
+    while (cap < blk_cnt)
+        cap *= 2;
+
+    data = (uint8_t **)realloc(inode->data, cap * sizeof(uint8_t *));
+    if (data == NULL)
+        return -NFS_ERROR_NOSPACE;
+    inode->data = data;
+    new_bytes = NFS_ROUND_UP(cap, UINT8_BITS) / UINT8_BITS;
+    dirty = (uint8_t *)realloc(inode->data_dirty, new_bytes);
+    if (dirty == NULL)
+        return -NFS_ERROR_NOSPACE;
+    inode->data_dirty = dirty;
+    resident = (uint8_t *)realloc(inode->data_resident, new_bytes);
+    if (resident == NULL)
+        return -NFS_ERROR_NOSPACE;
+    inode->data_resident = resident;
+
+    memset(inode->data + inode->data_cap, 0, (cap - inode->data_cap) * sizeof(uint8_t *));
+    memset(inode->data_dirty + old_bytes, 0, new_bytes - old_bytes);
+    memset(inode->data_resident + old_bytes, 0, new_bytes - old_bytes);
+    inode->data_cap = cap;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 扩大extents，使其至少容纳 cnt 项
+ */
+static int nfs_extent_reserve(struct nfs_inode *inode, int cnt)
+{
+    int cap = inode->extent_cap ? inode->extent_cap : NFS_EXTENT_PER_FILE;
+    struct nfs_extent *extents;
+
+    if (cnt <= inode->extent_cap)
+        return NFS_ERROR_NONE;
+    while (cap < cnt)
+        cap *= 2;
+    extents = (struct nfs_extent *)realloc(inode->extents, cap * sizeof(struct nfs_extent));
+    if (extents == NULL)
+        return -NFS_ERROR_NOSPACE;
+    inode->extents = extents;
+    inode->extent_cap = cap;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 文件第 blk_idx 块对应的数据块号
+ *
+ * 记住上次命中的extent，顺序读写时从它开始找，不必每次从头遍历
+ *
+ * @return int 数据块号，超出已分配范围返回-1
+ */
+int nfs_bmap(struct nfs_inode *inode, int blk_idx)
+{
+    int ext = inode->bmap_ext;
+    int base = inode->bmap_base;
+
+    if (ext >= inode->extent_cnt || blk_idx < base)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+        ext = 0;
+        base = 0;
+    }
+    for (; ext < inode->extent_cnt; ext++)
+    {
+        if (blk_idx < base + inode->extents[ext].len)
         {
-            if ((nfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0)
-            {
-                /* 当前ino_cursor位置空闲 */
-                nfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;
-                break;
-            }
-            ino_cursor++;
+            inode->bmap_ext = ext;
+            inode->bmap_base = base;
+            return inode->extents[ext].start + blk_idx - base;
         }
-        if (is_find_free_entry)
-            break;
+        base += inode->extents[ext].len;
     }
-    if (!is_find_free_entry || ino_cursor == nfs_super.num_ino)
+    return -1;
+}
+/**
+ * @brief 为inode分配数据块直到共有 blk_cnt 块，新块能接在最后一个extent后面时直接延长它
+ *
+ * 普通文件新分配的块在内存中清零并标记为脏，否则磁盘上残留的旧内容会在回收后重新露出来
+ */
+int nfs_inode_grow(struct nfs_inode *inode, int blk_cnt)
+{
+    struct nfs_extent *last;
+    int start, len, goal, i;
+
+    if (NFS_IS_REG(inode) && nfs_data_reserve(inode, blk_cnt) != NFS_ERROR_NONE)
         return -NFS_ERROR_NOSPACE;
-    printf("after alloc inode=======================\n");
-    nfs_dump_map_inode();
 
-    printf("before alloc data=======================\n");
-    nfs_dump_map_data();
-    // 从 data 位图里找空闲
-    int data_cursor = 0;
-    int free_data = 0;
-    int mark_blk[NFS_DATA_PER_FILE] = {0};
-    is_find_free_entry = FALSE;
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks); byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+    while (inode->blk_cnt < blk_cnt)
+    {
+        last = inode->extent_cnt ? &inode->extents[inode->extent_cnt - 1] : NULL;
+        goal = last ? last->start + last->len : -1;
+        len = nfs_alloc_run(goal, blk_cnt - inode->blk_cnt, &start);
+        if (len < 0)
+            return len;
+
+        if (last != NULL && start == goal)
+        {
+            last->len += len;
+        }
+        else if (inode->extent_cnt < NFS_EXTENT_MAX() &&
+                 nfs_extent_reserve(inode, inode->extent_cnt + 1) == NFS_ERROR_NONE)
         {
-            if ((nfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0)
+            inode->extents[inode->extent_cnt].start = start;
+            inode->extents[inode->extent_cnt].len = len;
+            inode->extent_cnt++;
+        }
+        else
+        {
+            /* extent用完，归还刚分配的块 */
+            NFS_ALLOC_LOCK();
+            for (i = 0; i < len; i++)
+                nfs_bitmap_clear(nfs_super.map_data, start + i);
+            NFS_ALLOC_UNLOCK();
+            return -NFS_ERROR_NOSPACE;
+        }
+
+        if (NFS_IS_REG(inode))
+        {
+            for (i = inode->blk_cnt; i < inode->blk_cnt + len; i++)
             {
-                /* 当前data_cursor位置空闲 */
-                nfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                mark_blk[free_data++] = data_cursor;
+                inode->data[i] = (uint8_t *)nfs_slab_zalloc(NFS_SLAB_BLK());
+                nfs_bitmap_set(inode->data_resident, i);
+                nfs_mark_data_dirty(inode, i);
+                nfs_icache_charge(inode, NFS_BLK_SZ());
             }
-            // 找到所需 data 块
-            if (free_data == NFS_DATA_PER_FILE)
-            {
-                is_find_free_entry = TRUE;
-                break;
-            }
-            data_cursor++;
         }
-        if (is_find_free_entry)
-            break;
+        inode->blk_cnt += len;
+        inode->flag |= NFS_FLAG_INODE_EXTENT_DIRTY;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放inode尾部的数据块，只保留前 blk_cnt 块
+ */
+void nfs_inode_shrink(struct nfs_inode *inode, int blk_cnt)
+{
+    struct nfs_extent *last;
+    int cut, i;
+
+    while (inode->blk_cnt > blk_cnt)
+    {
+        last = &inode->extents[inode->extent_cnt - 1];
+        cut = last->len < inode->blk_cnt - blk_cnt ? last->len : inode->blk_cnt - blk_cnt;
+        NFS_ALLOC_LOCK();
+        for (i = 1; i <= cut; i++)
+            nfs_bitmap_clear(nfs_super.map_data, last->start + last->len - i);
+        NFS_ALLOC_UNLOCK();
+        last->len -= cut;
+        if (last->len == 0)
+            inode->extent_cnt--;
+
+        for (i = inode->blk_cnt - cut; inode->data != NULL && i < inode->blk_cnt; i++)
+        {
+            if (inode->data[i] != NULL)
+                nfs_icache_charge(inode, -NFS_BLK_SZ());
+            nfs_slab_free(NFS_SLAB_BLK(), inode->data[i]);
+            inode->data[i] = NULL;
+            nfs_bitmap_clear(inode->data_dirty, i);
+            nfs_bitmap_clear(inode->data_resident, i);
+        }
+        inode->blk_cnt -= cut;
+        inode->flag |= NFS_FLAG_INODE_EXTENT_DIRTY;
+    }
+    /* 命中记录可能指向已删除的extent */
+    if (inode->bmap_ext >= inode->extent_cnt)
+    {
+        inode->bmap_ext = 0;
+        inode->bmap_base = 0;
+    }
+}
+/**
+ * @brief 释放一个元数据块（间接块）
+ */
+static void nfs_free_meta(int *blk)
+{
+    if (*blk >= 0)
+    {
+        NFS_ALLOC_LOCK();
+        nfs_bitmap_clear(nfs_super.map_data, *blk);
+        NFS_ALLOC_UNLOCK();
+    }
+    *blk = -1;
+}
+/**
+ * @brief 按extent数调整间接块：多余的释放，缺少的分配
+ *
+ * @param ind_need 是否需要一级间接块
+ * @param dind_need 需要的二级间接块下挂的一级块数，0表示不需要二级间接块
+ */
+static int nfs_ind_resize(struct nfs_inode *inode, boolean ind_need, int dind_need)
+{
+    int start;
+
+    while (inode->dind_cnt > dind_need)
+        nfs_free_meta(&inode->dind_blks[--inode->dind_cnt]);
+    if (dind_need == 0)
+    {
+        nfs_free_meta(&inode->dind_blk);
+        nfs_slab_free(NFS_SLAB_BLK(), inode->dind_blks);
+        inode->dind_blks = NULL;
+    }
+    if (!ind_need)
+        nfs_free_meta(&inode->ind_blk);
+
+    if (ind_need && inode->ind_blk < 0)
+    {
+        if (nfs_alloc_run(-1, 1, &start) < 0)
+            return -NFS_ERROR_NOSPACE;
+        inode->ind_blk = start;
+    }
+    if (dind_need > 0 && inode->dind_blk < 0)
+    {
+        if (nfs_alloc_run(-1, 1, &start) < 0)
+            return -NFS_ERROR_NOSPACE;
+        inode->dind_blk = start;
+        inode->dind_blks = (int *)nfs_slab_alloc(NFS_SLAB_BLK());
     }
-    if (!is_find_free_entry || data_cursor == nfs_super.num_data)
+    while (inode->dind_cnt < dind_need)
+    {
+        if (nfs_alloc_run(-1, 1, &start) < 0)
+            return -NFS_ERROR_NOSPACE;
+        inode->dind_blks[inode->dind_cnt++] = start;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 写回放不进inode的extent
+ *
+ * 前 NFS_EXTENT_PER_FILE 个在inode里，接下来 NFS_EXTENT_PER_BLK 个在一级间接块，
+ * 再往后每 NFS_EXTENT_PER_BLK 个占一个由二级间接块索引的块
+ */
+static int nfs_sync_extents(struct nfs_inode *inode)
+{
+    int rest = inode->extent_cnt - NFS_EXTENT_PER_FILE;
+    int epb = NFS_EXTENT_PER_BLK();
+    int dind_need = rest > epb ? NFS_ROUND_UP((rest - epb), epb) / epb : 0;
+    struct nfs_extent *cursor;
+    uint8_t *blk_buf;
+    int cnt, i;
+    int ret = NFS_ERROR_NONE;
+
+    if (nfs_ind_resize(inode, rest > 0, dind_need) != NFS_ERROR_NONE)
         return -NFS_ERROR_NOSPACE;
+    if (rest <= 0)
+        return NFS_ERROR_NONE;
 
-    printf("after alloc data=======================\n");
-    nfs_dump_map_data();
+    blk_buf = (uint8_t *)nfs_slab_alloc(NFS_SLAB_BLK());
+    cursor = inode->extents + NFS_EXTENT_PER_FILE;
+    for (i = -1; i < dind_need && ret == NFS_ERROR_NONE; i++)
+    {
+        /* i == -1 为一级间接块 */
+        cnt = rest < epb ? rest : epb;
+        memset(blk_buf, 0, NFS_BLK_SZ());
+        memcpy(blk_buf, cursor, cnt * sizeof(struct nfs_extent));
+        ret = nfs_driver_write(NFS_DATA_OFS(i < 0 ? inode->ind_blk : inode->dind_blks[i]),
+                               blk_buf, NFS_BLK_SZ());
+        cursor += cnt;
+        rest -= cnt;
+    }
+    if (ret == NFS_ERROR_NONE && dind_need > 0)
+    {
+        memset(blk_buf, 0, NFS_BLK_SZ());
+        memcpy(blk_buf, inode->dind_blks, dind_need * sizeof(int));
+        ret = nfs_driver_write(NFS_DATA_OFS(inode->dind_blk), blk_buf, NFS_BLK_SZ());
+    }
+    nfs_slab_free(NFS_SLAB_BLK(), blk_buf);
+    return ret;
+}
+/**
+ * @brief 预读数据区中的块，一次最多 NFS_CACHE_BATCH 块，这些块的读请求同时提交
+ *
+ * @param data_blks 数据块号
+ * @return int 提交预读的块数
+ */
+static int nfs_prefetch_data(const int *data_blks, int cnt)
+{
+    int blks[NFS_CACHE_BATCH];
+    int i;
 
-    inode = (struct nfs_inode *)malloc(sizeof(struct nfs_inode));
-    inode->ino = ino_cursor;
-    inode->size = 0;
-    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
-        inode->p_blk[i] = mark_blk[i];
+    if (cnt > NFS_CACHE_BATCH)
+        cnt = NFS_CACHE_BATCH;
+    for (i = 0; i < cnt; i++)
+        blks[i] = NFS_DATA_OFS(data_blks[i]) / NFS_BLK_SZ();
+    nfs_cache_prefetch(blks, cnt);
+    return cnt;
+}
+/**
+ * @brief 预读文件从第 first 块开始的 cnt 块中的前 NFS_CACHE_BATCH 块
+ *
+ * @return int 提交预读的块数
+ */
+static int nfs_prefetch_file(struct nfs_inode *inode, int first, int cnt)
+{
+    int data_blks[NFS_CACHE_BATCH];
+    int i;
 
-    /* dentry指向inode */
-    dentry->inode = inode;
-    dentry->ino = inode->ino;
-    /* inode指回dentry */
-    inode->dentry = dentry;
+    if (cnt > NFS_CACHE_BATCH)
+        cnt = NFS_CACHE_BATCH;
+    for (i = 0; i < cnt; i++)
+        data_blks[i] = nfs_bmap(inode, first + i);
+    return nfs_prefetch_data(data_blks, cnt);
+}
+/**
+ * @brief 读入间接块中的extent，与 nfs_sync_extents 对应
+ */
+static int nfs_read_extents(struct nfs_inode *inode)
+{
+    int rest = inode->extent_cnt - NFS_EXTENT_PER_FILE;
+    int epb = NFS_EXTENT_PER_BLK();
+    struct nfs_extent *cursor;
+    uint8_t *blk_buf;
+    int ind_blks[2];
+    int cnt, i;
 
-    inode->dir_cnt = 0;
-    inode->dentrys = NULL;
+    if (rest <= 0)
+        return NFS_ERROR_NONE;
+    /* 一级、二级间接块同时读入，二级间接块指向的各块随后也一起读入 */
+    ind_blks[0] = inode->ind_blk;
+    ind_blks[1] = inode->dind_blk;
+    nfs_prefetch_data(ind_blks, inode->dind_blk >= 0 ? 2 : 1);
+    if (inode->dind_blk >= 0)
+    {
+        inode->dind_blks = (int *)nfs_slab_alloc(NFS_SLAB_BLK());
+        inode->dind_cnt = NFS_ROUND_UP((rest - epb), epb) / epb;
+        if (nfs_driver_read(NFS_DATA_OFS(inode->dind_blk), (uint8_t *)inode->dind_blks,
+                            NFS_BLK_SZ()) != NFS_ERROR_NONE)
+            return -NFS_ERROR_IO;
+    }
 
-    /* 文件分配数据块 */
-    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+    blk_buf = (uint8_t *)nfs_slab_alloc(NFS_SLAB_BLK());
+    cursor = inode->extents + NFS_EXTENT_PER_FILE;
+    for (i = -1; rest > 0; i++)
     {
-        inode->data[i] = (uint8_t *)malloc(NFS_BLK_SZ());
+        if (i >= 0 && i % NFS_CACHE_BATCH == 0)
+            nfs_prefetch_data(inode->dind_blks + i, inode->dind_cnt - i);
+        cnt = rest < epb ? rest : epb;
+        if (nfs_driver_read(NFS_DATA_OFS(i < 0 ? inode->ind_blk : inode->dind_blks[i]),
+                            blk_buf, NFS_BLK_SZ()) != NFS_ERROR_NONE)
+        {
+            nfs_slab_free(NFS_SLAB_BLK(), blk_buf);
+            return -NFS_ERROR_IO;
+        }
+        memcpy(cursor, blk_buf, cnt * sizeof(struct nfs_extent));
+        cursor += cnt;
+        rest -= cnt;
     }
+    nfs_slab_free(NFS_SLAB_BLK(), blk_buf);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 沿父目录向上标记“子树有脏inode”，遇到已标记的祖先即可停止。调用者持有树锁
+ */
+void nfs_mark_sub_dirty(struct nfs_inode *inode)
+{
+    struct nfs_dentry *parent = inode->dentry->parent;
 
-    return inode;
+    while (parent != NULL && parent->inode != NULL)
+    {
+        if (NFS_INODE_IS_SUB_DIRTY(parent->inode))
+            break;
+        parent->inode->flag |= NFS_FLAG_INODE_SUB_DIRTY;
+        parent = parent->parent;
+    }
+}
+/**
+ * @brief 标记inode本身（大小、数据块指针、目录项等）需要回写。调用者持有树锁
+ */
+void nfs_mark_inode_dirty(struct nfs_inode *inode)
+{
+    inode->flag |= NFS_FLAG_INODE_DIRTY;
+    nfs_mark_sub_dirty(inode);
+}
+/**
+ * @brief 标记inode的第blk_idx个数据块需要回写
+ *
+ * 只在inode的写锁下修改inode本身，祖先的标记由调用者放回inode时在树锁下补上
+ */
+void nfs_mark_data_dirty(struct nfs_inode *inode, int blk_idx)
+{
+    nfs_bitmap_set(inode->data_dirty, blk_idx);
+    inode->flag |= NFS_FLAG_INODE_DATA_DIRTY;
 }
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 将内存inode及其下方结构中的脏数据刷回磁盘，干净的子树直接跳过
  */
 int nfs_sync_inode(struct nfs_inode *inode)
 {
     struct nfs_inode_d inode_d;
-    struct nfs_dentry_d dentry_d;
+    struct nfs_dentry_d *dentry_d;
+    struct nfs_dentry *dentry_cursor;
+    struct nfs_inode *inode_cursor;
+    struct nfs_dirent *dirent;
+    uint8_t *blk_buf;
+    int ino = inode->ino;
+    int blk_need, blk_idx, i, ret;
 
-    memcpy(inode_d.target_path, inode->target_path, NFS_MAX_FILE_NAME);
+    /* 目录项数变化后，先按需要的块数增减目录的数据块 */
+    if (NFS_IS_DIR(inode) && (inode->flag & NFS_FLAG_INODE_DIRTY))
+    {
+        blk_need = NFS_ROUND_UP(inode->dir_cnt, NFS_DENTRY_PER_BLK()) / NFS_DENTRY_PER_BLK();
+        if (blk_need > inode->blk_cnt && nfs_inode_grow(inode, blk_need) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] no space for dentrys\n", __func__);
+            return -NFS_ERROR_NOSPACE;
+        }
+        nfs_inode_shrink(inode, blk_need);
+    }
 
-    int ino = inode->ino;
-    inode_d.ino = ino;
-    inode_d.size = inode->size;
-    inode_d.ftype = inode->dentry->ftype;
-    inode_d.dir_cnt = inode->dir_cnt;
-    // 数据块指针
-    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
-        inode_d.p_blk[i] = inode->p_blk[i];
-    // 写此 inode
-    if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d,
-                         sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE)
+    if ((inode->flag & NFS_FLAG_INODE_EXTENT_DIRTY) && nfs_sync_extents(inode) != NFS_ERROR_NONE)
     {
-        NFS_DBG("[%s] io error\n", __func__);
+        NFS_DBG("[%s] sync extents error\n", __func__);
         return -NFS_ERROR_IO;
     }
+    inode->flag &= ~NFS_FLAG_INODE_EXTENT_DIRTY;
+
+    if (inode->flag & NFS_FLAG_INODE_DIRTY)
+    {
+        memset(&inode_d, 0, sizeof(struct nfs_inode_d));
+        memcpy(inode_d.target_path, inode->target_path, NFS_MAX_FILE_NAME);
+        inode_d.ino = ino;
+        inode_d.size = inode->size;
+        inode_d.ftype = inode->dentry->ftype;
+        inode_d.dir_cnt = inode->dir_cnt;
+        // 数据块extent
+        inode_d.blk_cnt = inode->blk_cnt;
+        inode_d.extent_cnt = inode->extent_cnt;
+        memcpy(inode_d.extents, inode->extents,
+               (inode->extent_cnt < NFS_EXTENT_PER_FILE ? inode->extent_cnt : NFS_EXTENT_PER_FILE) *
+                   sizeof(struct nfs_extent));
+        inode_d.ind_blk = inode->ind_blk;
+        inode_d.dind_blk = inode->dind_blk;
+        // 写此 inode
+        if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d,
+                             sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+    }
     /* Cycle 1: 写 INODE */
     /* Cycle 2: 写 数据 */
-    if (NFS_IS_DIR(inode))
+    if (NFS_IS_DIR(inode) && (inode->flag & NFS_FLAG_INODE_DIRTY))
     {
-        /* 写此inode下面的dentry
-            inode对应的 6 个数据块不一定连续 */
-        int offset;
-        int blk_end;
-        int blk_used = 0;
-        struct nfs_dentry *dentry_cursor = inode->dentrys;
-        while (blk_used < NFS_DATA_PER_FILE && dentry_cursor != NULL)
+        /* 写此inode下面的dentry，每块写满 NFS_DENTRY_PER_BLK 项后整块写入 */
+        blk_buf = (uint8_t *)nfs_slab_alloc(NFS_SLAB_BLK());
+        dirent = inode->dirents;
+        for (blk_idx = 0; blk_idx < inode->blk_cnt; blk_idx++)
         {
-            offset = NFS_DATA_OFS(inode->p_blk[blk_used]);
-            blk_end = offset + NFS_BLK_SZ();
-            while (dentry_cursor != NULL)
+            memset(blk_buf, 0, NFS_BLK_SZ());
+            dentry_d = (struct nfs_dentry_d *)blk_buf;
+            for (i = 0; i < NFS_DENTRY_PER_BLK() && dirent < inode->dirents + inode->dir_cnt; i++)
+            {
+                memcpy(dentry_d[i].fname, NFS_DIRENT_NAME(inode, dirent), dirent->name_len);
+                dentry_d[i].ftype = dirent->ftype;
+                dentry_d[i].ino = dirent->ino;
+                dentry_d[i].valid = TRUE;
+                dirent++;
+            }
+            if (nfs_driver_write(NFS_DATA_OFS(nfs_bmap(inode, blk_idx)), blk_buf,
+                                 NFS_BLK_SZ()) != NFS_ERROR_NONE)
             {
-                memcpy(dentry_d.fname, dentry_cursor->fname, NFS_MAX_FILE_NAME);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                if (nfs_driver_write(offset, (uint8_t *)&dentry_d,
-                                     sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE)
-                {
-                    NFS_DBG("[%s] io error\n", __func__);
-                    return -NFS_ERROR_IO;
-                }
-                // 递归
-                if (dentry_cursor->inode != NULL)
-                    nfs_sync_inode(dentry_cursor->inode);
-                /*
-                    inode下面的dentry按链表形式存储，
-                    这个dentry写完了，写下一个dentry
-                 */
-                dentry_cursor = dentry_cursor->brother;
-                offset += sizeof(struct nfs_dentry_d);
-                // 这个数据块写满了
-                if (offset + sizeof(struct nfs_dentry_d) > blk_end)
-                {
-                    blk_used++;
-                    break;
-                }
+                NFS_DBG("[%s] io error\n", __func__);
+                nfs_slab_free(NFS_SLAB_BLK(), blk_buf);
+                return -NFS_ERROR_IO;
             }
         }
+        nfs_slab_free(NFS_SLAB_BLK(), blk_buf);
     }
-    else if (NFS_IS_REG(inode))
+    else if (NFS_IS_REG(inode) && (inode->flag & NFS_FLAG_INODE_DATA_DIRTY))
     {
-        for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+        for (blk_idx = 0; blk_idx < inode->blk_cnt; blk_idx++)
         {
-            if (nfs_driver_write(NFS_DATA_OFS(inode->p_blk[i]), inode->data[i],
+            if (!nfs_bitmap_test(inode->data_dirty, blk_idx))
+                continue;
+            if (nfs_driver_write(NFS_DATA_OFS(nfs_bmap(inode, blk_idx)), inode->data[blk_idx],
                                  NFS_BLK_SZ()) != NFS_ERROR_NONE)
             {
                 NFS_DBG("[%s] io error\n", __func__);
 
                 return -NFS_ERROR_IO;
             }
+            nfs_bitmap_clear(inode->data_dirty, blk_idx);
         }
     }
+    inode->flag &= ~(NFS_FLAG_INODE_DIRTY | NFS_FLAG_INODE_DATA_DIRTY);
+
+    // 递归，只进入有脏inode的子树
+    if (NFS_IS_DIR(inode) && NFS_INODE_IS_SUB_DIRTY(inode))
+    {
+        for (i = 0; i < inode->dir_cnt; i++)
+        {
+            dentry_cursor = inode->dirents[i].dentry;
+            if (dentry_cursor == NULL || dentry_cursor->inode == NULL)
+                continue;
+            inode_cursor = dentry_cursor->inode;
+            /* 目录在树锁下，普通文件还要等正在进行的读写结束 */
+            if (!NFS_IS_DIR(inode_cursor))
+                pthread_rwlock_wrlock(&inode_cursor->rwlock);
+            ret = NFS_ERROR_NONE;
+            if (NFS_INODE_IS_DIRTY(inode_cursor) || NFS_INODE_IS_SUB_DIRTY(inode_cursor))
+                ret = nfs_sync_inode(inode_cursor);
+            if (!NFS_IS_DIR(inode_cursor))
+                pthread_rwlock_unlock(&inode_cursor->rwlock);
+            if (ret != NFS_ERROR_NONE)
+                return -NFS_ERROR_IO;
+        }
+        inode->flag &= ~NFS_FLAG_INODE_SUB_DIRTY;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 读入目录子树中所有未读入或已被淘汰的inode，删除前调用
+ */
+static int nfs_load_subtree(struct nfs_inode *inode)
+{
+    struct nfs_dentry *dentry_cursor;
+    int i;
+
+    for (i = 0; NFS_IS_DIR(inode) && i < inode->dir_cnt; i++)
+    {
+        dentry_cursor = nfs_dir_dentry(inode, i);
+        if (dentry_cursor->inode == NULL)
+            dentry_cursor->inode = nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+        if (dentry_cursor->inode == NULL || nfs_load_subtree(dentry_cursor->inode) != NFS_ERROR_NONE)
+            return -NFS_ERROR_IO;
+    }
     return NFS_ERROR_NONE;
 }
+/**
+ * @brief 释放inode及其子树，子树中的inode都已读入
+ */
+static void nfs_drop_tree(struct nfs_inode *inode)
+{
+    int i;
+
+    /* 数据块的内容不再需要，归还位图之前先丢弃，以免被重新分配后误删 */
+    for (i = 0; i < inode->extent_cnt; i++)
+        nfs_cache_discard(NFS_DATA_OFS(inode->extents[i].start),
+                          NFS_BLKS_SZ(inode->extents[i].len));
+
+    /* 调整inodemap和datamap */
+    NFS_ALLOC_LOCK();
+    nfs_bitmap_clear(nfs_super.map_inode, inode->ino);
+    NFS_ALLOC_UNLOCK();
+    nfs_inode_shrink(inode, 0);
+    nfs_ind_resize(inode, FALSE, 0);
+    free(inode->extents);
+
+    if (NFS_IS_DIR(inode))
+    {
+        /* 子目录项随后释放，先清掉路径缓存中指向它们的条目 */
+        nfs_dcache_forget(inode->dentry);
+        /* 递归向下drop */
+        for (i = 0; i < inode->dir_cnt; i++)
+            nfs_drop_tree(nfs_dir_dentry(inode, i)->inode);
+        nfs_dir_free(inode);
+        /* 释放子目录项时还会记账，最后再整体移出缓存 */
+        nfs_icache_remove(inode);
+        pthread_rwlock_destroy(&inode->rwlock);
+        nfs_slab_free(NFS_SLAB_INODE(), inode);
+    }
+    else if (NFS_IS_REG(inode) || NFS_IS_SYM_LINK(inode))
+    {
+        free(inode->data);
+        free(inode->data_dirty);
+        free(inode->data_resident);
+        nfs_icache_remove(inode);
+        pthread_rwlock_destroy(&inode->rwlock);
+        nfs_slab_free(NFS_SLAB_INODE(), inode);
+    }
+}
 /**
  * @brief 删除内存中的一个inode， 暂时不释放
  * Case 1: Reg File
@@ -341,78 +1071,163 @@ int nfs_sync_inode(struct nfs_inode *inode)
  *                Dentry -> Dentry
  *
  *   Recursive
+ *
+ * @return int 子树中有inode读不出来时返回 -NFS_ERROR_IO，此时什么都没有删除
  */
 int nfs_drop_inode(struct nfs_inode *inode)
 {
-    struct nfs_dentry *dentry_cursor;
-    struct nfs_dentry *dentry_to_free;
-    struct nfs_inode *inode_cursor;
-
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    boolean is_find = FALSE;
-
     if (inode == nfs_super.root_dentry->inode)
         return NFS_ERROR_INVAL;
 
-    if (NFS_IS_DIR(inode))
+    /* 未读入或已被淘汰的inode要先读入，才能释放它们占用的块 */
+    if (nfs_load_subtree(inode) != NFS_ERROR_NONE)
+        return -NFS_ERROR_IO;
+    nfs_drop_tree(inode);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放已被删除且不再被打开的孤儿inode，它的dentry不在任何目录中，一并释放
+ *
+ * @return int 失败时inode原样保留，仍带着孤儿标记，之后再试
+ */
+int nfs_drop_orphan(struct nfs_inode *inode)
+{
+    struct nfs_dentry *dentry = inode->dentry;
+
+    if (nfs_drop_inode(inode) != NFS_ERROR_NONE)
+        return -NFS_ERROR_IO;
+    nfs_slab_free(NFS_SLAB_DENTRY(), dentry);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 读入文件第 [first, first + cnt) 块，物理上连续的块合并为一次读
+ */
+static int nfs_read_blocks(struct nfs_inode *inode, int first, int cnt)
+{
+    uint8_t *buf;
+    int ahead = first;
+    int blk, run, i, k;
+
+    for (i = first; i < first + cnt; i += run)
     {
-        dentry_cursor = inode->dentrys;
-        /* 递归向下drop */
-        while (dentry_cursor)
+        /* 先一起提交后面一批块的读请求，下面的读在块缓存中命中 */
+        if (i >= ahead)
+            ahead = i + nfs_prefetch_file(inode, i, first + cnt - i);
+        blk = nfs_bmap(inode, i);
+        for (run = 1; i + run < first + cnt && nfs_bmap(inode, i + run) == blk + run; run++)
+            ;
+        buf = (uint8_t *)malloc(NFS_BLKS_SZ(run));
+        if (nfs_driver_read(NFS_DATA_OFS(blk), buf, NFS_BLKS_SZ(run)) != NFS_ERROR_NONE)
         {
-            inode_cursor = dentry_cursor->inode;
-            nfs_drop_inode(inode_cursor);
-            nfs_drop_dentry(inode, dentry_cursor);
-            dentry_to_free = dentry_cursor;
-            dentry_cursor = dentry_cursor->brother;
-            free(dentry_to_free);
+            free(buf);
+            return -NFS_ERROR_IO;
         }
-    }
-    else if (NFS_IS_REG(inode) || NFS_IS_SYM_LINK(inode))
-    {
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks);
-             byte_cursor++) /* 调整inodemap */
+        for (k = 0; k < run; k++)
         {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+            if (inode->data[i + k] == NULL)
             {
-                if (ino_cursor == inode->ino)
-                {
-                    nfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                    is_find = TRUE;
-                    break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE)
-            {
-                break;
+                inode->data[i + k] = (uint8_t *)nfs_slab_alloc(NFS_SLAB_BLK());
+                nfs_icache_charge(inode, NFS_BLK_SZ());
             }
+            memcpy(inode->data[i + k], buf + NFS_BLKS_SZ(k), NFS_BLK_SZ());
+            nfs_bitmap_set(inode->data_resident, i + k);
         }
-        for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+        free(buf);
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 保证文件 [offset, offset + size) 所在的块都已读入内存
+ *
+ * 打开inode时不读数据块，到真正读写时才按范围调入。写操作中被整块覆盖的块
+ * 不需要先读，直接分配缓冲即可
+ *
+ * @param is_write 是否为写操作
+ * @return int 0成功，否则失败
+ */
+int nfs_load_data(struct nfs_inode *inode, int offset, int size, boolean is_write)
+{
+    int first = offset / NFS_BLK_SZ();
+    int end = NFS_ROUND_UP((offset + size), NFS_BLK_SZ()) / NFS_BLK_SZ();
+    int i, run;
+
+    if (end > inode->blk_cnt)
+        end = inode->blk_cnt;
+    for (i = first; i < end; i += run)
+    {
+        run = 1;
+        if (nfs_bitmap_test(inode->data_resident, i))
+            continue;
+        if (is_write && offset <= NFS_BLKS_SZ(i) && offset + size >= NFS_BLKS_SZ(i + 1))
         {
-            if (inode->data[i])
-                free(inode->data[i]);
+            if (inode->data[i] == NULL)
+            {
+                inode->data[i] = (uint8_t *)nfs_slab_alloc(NFS_SLAB_BLK());
+                nfs_icache_charge(inode, NFS_BLK_SZ());
+            }
+            nfs_bitmap_set(inode->data_resident, i);
+            continue;
         }
-        free(inode);
+        /* 连续的未调入块一次读入 */
+        while (i + run < end && !nfs_bitmap_test(inode->data_resident, i + run))
+            run++;
+        if (nfs_read_blocks(inode, i, run) != NFS_ERROR_NONE)
+            return -NFS_ERROR_IO;
     }
     return NFS_ERROR_NONE;
 }
+/**
+ * @brief [offset, offset + size) 所在的块是否都已调入，是则 nfs_load_data 不会修改inode
+ */
+boolean nfs_data_loaded(struct nfs_inode *inode, int offset, int size)
+{
+    int end = NFS_ROUND_UP((offset + size), NFS_BLK_SZ()) / NFS_BLK_SZ();
+    int i;
+
+    if (end > inode->blk_cnt)
+        end = inode->blk_cnt;
+    for (i = offset / NFS_BLK_SZ(); i < end; i++)
+    {
+        if (!nfs_bitmap_test(inode->data_resident, i))
+            return FALSE;
+    }
+    return TRUE;
+}
+/**
+ * @brief nfs_read_inode 失败时释放已建立的部分，此时inode还没有加入缓存
+ */
+static void nfs_read_inode_abort(struct nfs_inode *inode)
+{
+    nfs_dir_free(inode);
+    free(inode->data);
+    free(inode->data_dirty);
+    free(inode->data_resident);
+    free(inode->extents);
+    nfs_slab_free(NFS_SLAB_BLK(), inode->dind_blks);
+    /* 加入缓存前的占用已计入总量，这里整体扣除 */
+    nfs_icache_charge(inode, -inode->mem);
+    pthread_rwlock_destroy(&inode->rwlock);
+    nfs_slab_free(NFS_SLAB_INODE(), inode);
+}
 /**
  * @param dentry dentry指向ino，读取该inode
  * @param ino inode唯一编号
  */
 struct nfs_inode *nfs_read_inode(struct nfs_dentry *dentry, int ino)
 {
-    struct nfs_inode *inode = (struct nfs_inode *)malloc(sizeof(struct nfs_inode));
+    struct nfs_inode *inode = (struct nfs_inode *)nfs_slab_alloc(NFS_SLAB_INODE());
     struct nfs_inode_d inode_d;
-    struct nfs_dentry *sub_dentry;
-    struct nfs_dentry_d dentry_d;
+    struct nfs_dentry_d *dentry_d;
+    uint8_t *blk_buf;
+    int blk_idx, i, dir_cnt, blk_need;
+    int ahead = 0;
+    if (inode == NULL)
+        return NULL;
     if (nfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d,
                         sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE)
     {
         NFS_DBG("[%s] io error\n", __func__);
+        nfs_slab_free(NFS_SLAB_INODE(), inode);
         return NULL;
     }
     inode->dir_cnt = 0;
@@ -420,73 +1235,104 @@ struct nfs_inode *nfs_read_inode(struct nfs_dentry *dentry, int ino)
     inode->size = inode_d.size;
     memcpy(inode->target_path, inode_d.target_path, NFS_MAX_FILE_NAME);
     inode->dentry = dentry;
-    inode->dentrys = NULL;
-    // 保存数据块指针
-    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
-        inode->p_blk[i] = inode_d.p_blk[i];
+    inode->dirents = NULL;
+    inode->dirent_cap = 0;
+    inode->names = NULL;
+    inode->names_len = 0;
+    inode->names_cap = 0;
+    inode->names_dead = 0;
+    inode->dir_index = NULL;
+    inode->index_sz = 0;
+    inode->flag = 0;
+    inode->data = NULL;
+    inode->data_cap = 0;
+    inode->data_dirty = NULL;
+    inode->data_resident = NULL;
+    inode->ref_cnt = 0;
+    inode->child_cnt = 0;
+    inode->mem = 0;
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+    pthread_rwlock_init(&inode->rwlock, NULL);
+    // 保存数据块extent
+    inode->blk_cnt = inode_d.blk_cnt;
+    inode->extent_cnt = inode_d.extent_cnt;
+    inode->extent_cap = 0;
+    inode->extents = NULL;
+    inode->ind_blk = inode_d.ind_blk;
+    inode->dind_blk = inode_d.dind_blk;
+    inode->dind_blks = NULL;
+    inode->dind_cnt = 0;
+    inode->bmap_ext = 0;
+    inode->bmap_base = 0;
+    if (nfs_extent_reserve(inode, inode->extent_cnt) != NFS_ERROR_NONE)
+    {
+        nfs_read_inode_abort(inode);
+        return NULL;
+    }
+    memcpy(inode->extents, inode_d.extents,
+           (inode->extent_cnt < NFS_EXTENT_PER_FILE ? inode->extent_cnt : NFS_EXTENT_PER_FILE) *
+               sizeof(struct nfs_extent));
+    if (nfs_read_extents(inode) != NFS_ERROR_NONE)
+    {
+        NFS_DBG("[%s] io error\n", __func__);
+        nfs_read_inode_abort(inode);
+        return NULL;
+    }
 
     if (NFS_IS_DIR(inode))
     {
-        //读目录项，一块一块读
-        int blk_cnt = 0;
-        int begin = NFS_DATA_OFS(inode->p_blk[0]);
-        int blk_end = begin + NFS_BLK_SZ();
-        for (int i = 0; i < inode_d.dir_cnt; i++)
+        //读目录项，一块一块读，每批块的读请求预先一起提交
+        blk_need = NFS_ROUND_UP(inode_d.dir_cnt, NFS_DENTRY_PER_BLK()) / NFS_DENTRY_PER_BLK();
+        if (blk_need > inode->blk_cnt)
+            blk_need = inode->blk_cnt;
+        blk_buf = (uint8_t *)nfs_slab_alloc(NFS_SLAB_BLK());
+        dir_cnt = 0;
+        for (blk_idx = 0; blk_idx < inode->blk_cnt && dir_cnt < inode_d.dir_cnt; blk_idx++)
         {
-            if (begin + sizeof(struct nfs_dentry_d) >= blk_end)
-            {
-                begin = NFS_DATA_OFS(inode->p_blk[++blk_cnt]);
-                blk_end = begin + NFS_BLK_SZ();
-            }
-            if (nfs_driver_read(begin, (uint8_t *)&dentry_d, sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE)
+            if (blk_idx >= ahead)
+                ahead = blk_idx + nfs_prefetch_file(inode, blk_idx, blk_need - blk_idx);
+            if (nfs_driver_read(NFS_DATA_OFS(nfs_bmap(inode, blk_idx)), blk_buf,
+                                NFS_BLK_SZ()) != NFS_ERROR_NONE)
             {
                 NFS_DBG("[%s] io error\n", __func__);
+                nfs_slab_free(NFS_SLAB_BLK(), blk_buf);
+                nfs_read_inode_abort(inode);
                 return NULL;
             }
-            sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->ino = dentry_d.ino;
-            nfs_alloc_dentry(inode, sub_dentry);
-
-            begin += sizeof(struct nfs_dentry_d);
+            dentry_d = (struct nfs_dentry_d *)blk_buf;
+            /* 只建立记录，查找到时才建立dentry */
+            for (i = 0; i < NFS_DENTRY_PER_BLK() && dir_cnt < inode_d.dir_cnt; i++, dir_cnt++)
+                nfs_dir_append(inode, dentry_d[i].fname, dentry_d[i].ino, dentry_d[i].ftype);
         }
+        nfs_slab_free(NFS_SLAB_BLK(), blk_buf);
     }
-    // 读文件
+    // 文件只准备好块指针数组，数据块在读写时由 nfs_load_data 调入
     else if (NFS_IS_REG(inode))
     {
-        for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+        if (nfs_data_reserve(inode, inode->blk_cnt) != NFS_ERROR_NONE)
         {
-            inode->data[i] = (uint8_t *)malloc(NFS_BLK_SZ());
-            if (nfs_driver_read(NFS_DATA_OFS(inode->p_blk[i]), (uint8_t *)inode->data[i], NFS_BLK_SZ()) != NFS_ERROR_NONE)
-            {
-                NFS_DBG("[%s] io error\n", __func__);
-                return NULL;
-            }
+            nfs_read_inode_abort(inode);
+            return NULL;
         }
     }
+    nfs_icache_add(inode);
     return inode;
 }
 /**
- * @brief
+ * @brief 目录的第 dir 条记录
  *
  * @param inode
  * @param dir [0...]
- * @return struct nfs_dentry*
+ * @return struct nfs_dirent* 超出目录项数返回NULL
  */
-struct nfs_dentry *nfs_get_dentry(struct nfs_inode *inode, int dir)
+struct nfs_dirent *nfs_get_dirent(struct nfs_inode *inode, int dir)
 {
-    struct nfs_dentry *dentry_cursor = inode->dentrys;
-    int cnt = 0;
-    while (dentry_cursor)
+    if (dir < 0 || dir >= inode->dir_cnt)
     {
-        if (dir == cnt)
-        {
-            return dentry_cursor;
-        }
-        cnt++;
-        dentry_cursor = dentry_cursor->brother;
+        return NULL;
     }
-    return NULL;
+    return &inode->dirents[dir];
 }
 /**
  * @brief
@@ -500,8 +1346,10 @@ struct nfs_dentry *nfs_get_dentry(struct nfs_inode *inode, int dir)
  *      1) find /'s inode       lvl = 1
  *      2) find qwe's dentry
  *
+ * 调用者持有树锁，返回的dentry及其inode在释放树锁后只有用 nfs_icache_get 固定才能继续使用
+ *
  * @param path
- * @return struct nfs_inode*
+ * @return struct nfs_dentry* 路径上被淘汰的inode读不回来时返回NULL，此时 is_find 为FALSE
  */
 struct nfs_dentry *nfs_lookup(const char *path, boolean *is_find, boolean *is_root)
 {
@@ -510,11 +1358,12 @@ struct nfs_dentry *nfs_lookup(const char *path, boolean *is_find, boolean *is_ro
     struct nfs_inode *inode;
     int total_lvl = nfs_calc_lvl(path);
     int lvl = 0;
-    boolean is_hit;
     char *fname = NULL;
-    char *path_cpy = (char *)malloc(sizeof(path));
+    char *path_cpy = (char *)malloc(strlen(path) + 1);
     *is_root = FALSE;
     strcpy(path_cpy, path);
+    /* 上一次操作用到的inode已不再使用，此时按预算淘汰 */
+    nfs_icache_shrink();
 
     if (total_lvl == 0)
     { /* 根目录 */
@@ -522,39 +1371,50 @@ struct nfs_dentry *nfs_lookup(const char *path, boolean *is_find, boolean *is_ro
         *is_root = TRUE;
         dentry_ret = nfs_super.root_dentry;
     }
+    else if ((dentry_ret = nfs_dcache_lookup(path, is_find)) != NULL)
+    { /* 路径缓存命中，包括负项 */
+        free(path_cpy);
+        if (dentry_ret->inode == NULL)
+            dentry_ret->inode = nfs_read_inode(dentry_ret, dentry_ret->ino);
+        if (dentry_ret->inode == NULL)
+        {
+            *is_find = FALSE;
+            return NULL;
+        }
+        nfs_icache_touch(dentry_ret->inode);
+        return dentry_ret;
+    }
     fname = strtok(path_cpy, "/");
     while (fname)
     {
         lvl++;
         if (dentry_cursor->inode == NULL)
         { /* Cache机制 */
-            nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            dentry_cursor->inode = nfs_read_inode(dentry_cursor, dentry_cursor->ino);
         }
 
         inode = dentry_cursor->inode;
+        if (inode == NULL)
+        {
+            NFS_DBG("[%s] read inode %d error\n", __func__, dentry_cursor->ino);
+            *is_find = FALSE;
+            dentry_ret = NULL;
+            break;
+        }
 
-        if (NFS_IS_REG(inode) && lvl < total_lvl)
+        if (!NFS_IS_DIR(inode))
         {
             NFS_DBG("[%s] not a dir\n", __func__);
+            *is_find = FALSE;
             dentry_ret = inode->dentry;
             break;
         }
-        if (NFS_IS_DIR(inode))
+        else
         {
-            dentry_cursor = inode->dentrys;
-            is_hit = FALSE;
+            /* 按文件名哈希索引，每层O(1) */
+            dentry_cursor = nfs_find_dentry(inode, fname);
 
-            while (dentry_cursor)
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0)
-                {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
-
-            if (!is_hit)
+            if (dentry_cursor == NULL)
             {
                 *is_find = FALSE;
                 NFS_DBG("[%s] not found %s\n", __func__, fname);
@@ -562,7 +1422,7 @@ struct nfs_dentry *nfs_lookup(const char *path, boolean *is_find, boolean *is_ro
                 break;
             }
 
-            if (is_hit && lvl == total_lvl)
+            if (lvl == total_lvl)
             {
                 *is_find = TRUE;
                 dentry_ret = dentry_cursor;
@@ -571,19 +1431,50 @@ struct nfs_dentry *nfs_lookup(const char *path, boolean *is_find, boolean *is_ro
         }
         fname = strtok(NULL, "/");
     }
-
-    if (dentry_ret->inode == NULL)
+    free(path_cpy);
+    if (dentry_ret != NULL && dentry_ret->inode == NULL)
     {
         dentry_ret->inode = nfs_read_inode(dentry_ret, dentry_ret->ino);
     }
+    /* 读不回inode时不缓存这条路径，下次查找重试 */
+    if (dentry_ret == NULL || dentry_ret->inode == NULL)
+    {
+        *is_find = FALSE;
+        return NULL;
+    }
+    if (total_lvl != 0)
+        nfs_dcache_insert(path, dentry_ret, *is_find);
+    nfs_icache_touch(dentry_ret->inode);
 
     return dentry_ret;
 }
+/**
+ * @brief 预读inode位图、数据位图和根inode，最多占用一半块缓存
+ */
+static void nfs_mount_prefetch(struct nfs_super_d *super_d)
+{
+    int map_inode_blk = super_d->map_inode_offset / NFS_BLK_SZ();
+    int map_data_blk = super_d->map_data_offset / NFS_BLK_SZ();
+    int cnt = super_d->map_inode_blks + super_d->map_data_blks + 1;
+    int *blks;
+    int i;
+
+    if (cnt > NFS_CACHE_BLKS / 2)
+        return;
+    blks = (int *)malloc(cnt * sizeof(int));
+    for (i = 0; i < super_d->map_inode_blks; i++)
+        blks[i] = map_inode_blk + i;
+    for (i = 0; i < super_d->map_data_blks; i++)
+        blks[super_d->map_inode_blks + i] = map_data_blk + i;
+    blks[cnt - 1] = NFS_INO_OFS(NFS_ROOT_INO) / NFS_BLK_SZ();
+    nfs_cache_prefetch(blks, cnt);
+    free(blks);
+}
 /**
  * @brief 挂载newfs, Layout 如下
  *
  * Layout
- * | Super | Inode Map | Data Map | Data |
+ * | Super | Inode Map | Data Map | Inode | Data |
  *
  * BLK_SZ = 2 * IO_SZ
  *
@@ -601,6 +1492,8 @@ int nfs_mount(struct custom_options options)
     int inode_num;
     int map_inode_blks;
     int map_data_blks;
+    int io_depth;
+    int io_sched;
 
     boolean is_init = FALSE;
     nfs_super.is_mounted = FALSE;
@@ -613,6 +1506,18 @@ int nfs_mount(struct custom_options options)
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE, &nfs_super.sz_disk);
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &nfs_super.sz_io);
     nfs_super.sz_blk = 2 * nfs_super.sz_io; // nfs块大小 1024 B
+    io_depth = NFS_IO_DEPTH;                // 批量预读/回写的请求可以同时在途
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_QDEPTH, &io_depth);
+    io_sched = NFS_IO_SCHED;                // 批量请求按偏移排序派发，减少寻道
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SCHED, &io_sched);
+    pthread_mutex_init(&nfs_super.tree_lock, NULL);
+    pthread_mutex_init(&nfs_super.alloc_lock, NULL);
+    nfs_slab_init(NFS_SLAB_DENTRY(), "dentry", sizeof(struct nfs_dentry));
+    nfs_slab_init(NFS_SLAB_INODE(), "inode", sizeof(struct nfs_inode));
+    nfs_slab_init(NFS_SLAB_BLK(), "blk", NFS_BLK_SZ());
+    if (nfs_cache_init() != NFS_ERROR_NONE || nfs_dcache_init() != NFS_ERROR_NONE)
+        return -NFS_ERROR_NOSPACE;
+    nfs_icache_init(options.inode_cache_mb);
 
     root_dentry = new_dentry("/", NFS_DIR);
 
@@ -641,7 +1546,7 @@ int nfs_mount(struct custom_options options)
         nfs_super_d.map_inode_offset = NFS_SUPER_OFS + NFS_BLKS_SZ(super_blks);
         nfs_super_d.map_data_offset = nfs_super_d.map_inode_offset + NFS_BLKS_SZ(map_inode_blks);
         nfs_super_d.inode_offset = nfs_super_d.map_data_offset + NFS_BLKS_SZ(map_data_blks);
-        nfs_super_d.data_offset = nfs_super_d.map_data_offset + NFS_BLKS_SZ(nfs_super_d.num_ino);
+        nfs_super_d.data_offset = nfs_super_d.inode_offset + NFS_BLKS_SZ(nfs_super_d.num_ino);
 
         NFS_DBG("super blocks: %d\n", super_blks);
         NFS_DBG("inode map blocks: %d\n", map_inode_blks);
@@ -658,6 +1563,8 @@ int nfs_mount(struct custom_options options)
     nfs_super.sz_usage = nfs_super_d.sz_usage;
     nfs_super.num_ino = nfs_super_d.num_ino;
     nfs_super.num_data = NFS_DATA_PER_FILE * nfs_super_d.num_ino;
+    nfs_super.ino_hint = 0;
+    nfs_super.data_hint = 0;
 
     nfs_super.map_inode = (uint8_t *)calloc(NFS_BLKS_SZ(nfs_super_d.map_inode_blks), sizeof(uint8_t));
     nfs_super.map_inode_blks = nfs_super_d.map_inode_blks;
@@ -674,10 +1581,14 @@ int nfs_mount(struct custom_options options)
     if (is_init)
     {
         root_inode = nfs_alloc_inode(root_dentry);
+        nfs_mark_inode_dirty(root_inode);
         nfs_sync_inode(root_inode);
+        // 新建的根目录已在内存中，不必再读
     }
     else
     {
+        // 两张位图和根inode所在的块一起提交读入
+        nfs_mount_prefetch(&nfs_super_d);
         printf("before read inode map================\n");
         printf("inode map offset : %d\n",nfs_super_d.map_inode_offset);
         nfs_dump_map_inode();
@@ -697,9 +1608,10 @@ int nfs_mount(struct custom_options options)
             return -NFS_ERROR_IO;
         printf("after read data map================\n");
         nfs_dump_map_data();
+        root_inode = nfs_read_inode(root_dentry, NFS_ROOT_INO);
     }
-    root_inode = nfs_read_inode(root_dentry, NFS_ROOT_INO);
     root_dentry->inode = root_inode;
+    nfs_icache_get(root_inode); /* 根目录常驻 */
     nfs_super.root_dentry = root_dentry;
     nfs_super.is_mounted = TRUE;
     return ret;
@@ -708,10 +1620,13 @@ int nfs_mount(struct custom_options options)
 int nfs_umount()
 {
     struct nfs_super_d nfs_super_d;
+    struct ddriver_state_v2 state;
 
     if (!nfs_super.is_mounted)
         return NFS_ERROR_NONE;
 
+    /* 之前release时没能释放的孤儿inode，在回写位图之前再试一次 */
+    nfs_icache_drop_orphans();
     // 从根节点向下刷写节点
     nfs_sync_inode(nfs_super.root_dentry->inode);
 
@@ -725,6 +1640,7 @@ int nfs_umount()
     nfs_super_d.map_data_blks = nfs_super.map_data_blks;
     nfs_super_d.map_data_offset = nfs_super.map_data_offset;
 
+    nfs_super_d.inode_offset = nfs_super.inode_offset;
     nfs_super_d.data_offset = nfs_super.data_offset;
 
     // 回写super block
@@ -748,6 +1664,23 @@ int nfs_umount()
         return -NFS_ERROR_IO;
     free(nfs_super.map_data);
 
+    // 回写块缓存中的全部脏块
+    if (nfs_cache_sync() != NFS_ERROR_NONE)
+        return -NFS_ERROR_IO;
+    nfs_cache_destroy();
+    nfs_dcache_destroy();
+    nfs_icache_destroy();
+    nfs_slab_destroy(NFS_SLAB_DENTRY());
+    nfs_slab_destroy(NFS_SLAB_INODE());
+    nfs_slab_destroy(NFS_SLAB_BLK());
+    pthread_mutex_destroy(&nfs_super.tree_lock);
+    pthread_mutex_destroy(&nfs_super.alloc_lock);
+
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_STATE_V2, &state);
+    NFS_DBG("device read: %llu (%llu B), write: %llu (%llu B), seek: %llu, seek distance: %llu, "
+            "device time: %lld us\n",
+            state.read_cnt, state.read_bytes, state.write_cnt, state.write_bytes,
+            state.seek_cnt, state.seek_dist, state.sim_us);
     ddriver_close(NFS_DRIVER());
 
     return NFS_ERROR_NONE;
@@ -4,7 +4,7 @@ TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
 ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_SCORES=(1 4 5 4 16 4 2)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
@@ -39,4 +39,64 @@ touch_and_check "${MNTPOINT}"/file0
 core_tester echo "$GOLDEN" check_write "$TEST_CASE"
 
 TEST_CASE="case 6.2 - read ${MNTPOINT}/file0"
-core_tester echo "$GOLDEN" check_read "$TEST_CASE"
\ No newline at end of file
+core_tester echo "$GOLDEN" check_read "$TEST_CASE"
+
+function check_partial_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 文件占3块，重新挂载后都不在内存中，只改写第1块开头和第2块中间的几个字节
+    EXPECTED=$(mktemp)
+    head -c 3072 /dev/urandom > "$EXPECTED"
+    cp "$EXPECTED" "${MNTPOINT}"/file1
+    umount "${MNTPOINT}"
+    try_mount_or_fail
+    for SEEK in 256 640; do
+        printf 'ABCD' | dd of="${MNTPOINT}"/file1 bs=4 count=1 seek=$SEEK conv=notrunc 2>/dev/null
+        printf 'ABCD' | dd of="$EXPECTED" bs=4 count=1 seek=$SEEK conv=notrunc 2>/dev/null
+    done
+    # 再挂载一次，读到的是回写到磁盘上的内容
+    umount "${MNTPOINT}"
+    try_mount_or_fail
+
+    if ! cmp -s "$EXPECTED" "${MNTPOINT}"/file1; then
+        rm -f "$EXPECTED"
+        fail "$_TEST_CASE: 改写${MNTPOINT}/file1中的几个字节后, 所在块的其余内容被破坏"
+        return 1
+    fi
+    rm -f "$EXPECTED"
+    return 0
+}
+
+TEST_CASE="case 6.3 - partial write ${MNTPOINT}/file1 after remount"
+core_tester echo "$GOLDEN" check_partial_write "$TEST_CASE"
+
+function check_truncate_grow () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 截断到1块后再扩大，刚释放的块接在最后一个extent后面，会被重新分配回来
+    # 扩出来的部分重新挂载后也必须是0，不能露出原来的内容
+    EXPECTED=$(mktemp)
+    head -c 3072 /dev/urandom > "$EXPECTED"
+    cp "$EXPECTED" "${MNTPOINT}"/file2
+    umount "${MNTPOINT}"
+    try_mount_or_fail
+    truncate -s 1K "${MNTPOINT}"/file2
+    truncate -s 3K "${MNTPOINT}"/file2
+    truncate -s 1K "$EXPECTED"
+    truncate -s 3K "$EXPECTED"
+    umount "${MNTPOINT}"
+    try_mount_or_fail
+
+    if ! cmp -s "$EXPECTED" "${MNTPOINT}"/file2; then
+        rm -f "$EXPECTED"
+        fail "$_TEST_CASE: 截断后再扩大${MNTPOINT}/file2, 扩出来的部分读到的不是0"
+        return 1
+    fi
+    rm -f "$EXPECTED"
+    return 0
+}
+
+TEST_CASE="case 6.4 - truncate grow ${MNTPOINT}/file2 across remount"
+core_tester echo "$GOLDEN" check_truncate_grow "$TEST_CASE"
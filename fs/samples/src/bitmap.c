@@ -11,82 +11,65 @@ int create_bitmap(uint8_t ** bitmap, uint64_t * bitmap_size) {
     return 0;
 }
 
-int clear_bit(uint8_t ** bitmap, uint64_t bitno) {
-    uint64_t index = bitno / 8;
-    int bit_index = bitno % 8;
+/*
+Load the 64-bit word starting at byte `index`. Bit i of the word is bit i % 8 of
+byte index + i / 8, matching set_bit/clear_bit. Bytes past the end read as `pad`.
+*/
+static uint64_t load_word(uint8_t * bitmap, uint64_t index, uint64_t bitmap_size, uint8_t pad) {
+    uint64_t word = 0;
+    int i;
+
+    if (index + 8 <= bitmap_size) {
+        memcpy(&word, bitmap + index, sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        return word;
+    }
+    for (i = 0; i < 8; i++) {
+        uint8_t byte = index + i < bitmap_size ? bitmap[index + i] : pad;
+        word |= (uint64_t)byte << (i * 8);
+    }
+    return word;
+}
 
-    int val = (int)pow(2, bit_index);
-    (* bitmap)[index] = (* bitmap)[index] & ~(val);
+int clear_bit(uint8_t ** bitmap, uint64_t bitno) {
+    (* bitmap)[bitno / 8] &= (uint8_t)~(1U << (bitno % 8));
 
     return 0;
 }
 
 int set_bit(uint8_t ** bitmap, uint64_t bitno) {
-    uint64_t index = bitno / 8;
-    int bit_index = bitno % 8;
-
-    int val = (int)pow(2, bit_index);
-    (* bitmap)[index] = (* bitmap)[index] | (val);
+    (* bitmap)[bitno / 8] |= (uint8_t)(1U << (bitno % 8));
 
     return 0;
 }
 
 uint64_t get_first_unset_bit(uint8_t * bitmap, uint64_t bitmap_size) {
-    uint64_t index = 0;
-    int bit_index = 0;
-    int val, found = 0;
-
-    while(index < bitmap_size) {
-        bit_index = 0;
-        while(bit_index < 8) {
-            val = (int)pow(2, bit_index);
-            
-            if( !(bitmap[index] & val) ) {
-                found = 1;
-                break;
-            }
-            bit_index++;
-        }
-
-        if(!found)
-            index++;
-        else
-            break;
+    uint64_t index;
+    uint64_t word;
+
+    /* Skip full words, then locate the lowest zero bit */
+    for (index = 0; index < bitmap_size; index += 8) {
+        word = ~load_word(bitmap, index, bitmap_size, 0xff);
+        if (word)
+            return index * 8 + __builtin_ctzll(word);
     }
 
-    if(found)
-        return (index * 8 + bit_index);
-    else
-        return -1;
+    return -1;
 }
 
 uint64_t get_first_set_bit(uint8_t * bitmap, uint64_t bitmap_size) {
-    uint64_t index = 0;
-    int bit_index = 0;
-    int val, found = 0;
-
-    while(index < bitmap_size) {
-        bit_index = 0;
-        while(bit_index < 8) {
-            val = (int)pow(2, bit_index);
-            
-            if(bitmap[index] & val) {
-                found = 1;
-                break;
-            }
-            bit_index++;
-        }
+    uint64_t index;
+    uint64_t word;
 
-        if(!found)
-            index++;
-        else
-            break;
+    for (index = 0; index < bitmap_size; index += 8) {
+        word = load_word(bitmap, index, bitmap_size, 0);
+        if (word)
+            return index * 8 + __builtin_ctzll(word);
     }
 
-    if(found)
-        return (index * 8 + bit_index);
-    else
-        return -1;
+    return -1;
 }
 
 void print_bitmap(uint8_t * bitmap, uint64_t bitmap_size){
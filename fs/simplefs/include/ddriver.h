@@ -3,11 +3,23 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 int ddriver_open(char *path);
+int ddriver_open_ex(const char *path, const struct ddriver_options *opts);
+void ddriver_default_options(struct ddriver_options *opts);
+int ddriver_find_profile(const char *name, struct ddriver_profile *prof);
 int ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+int ddriver_submit(int fd, struct ddriver_req *req);
+int ddriver_poll(int fd, struct ddriver_req **reqs, int min_nr, int max_nr);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 int ddriver_close(int fd);
 
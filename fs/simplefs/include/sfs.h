@@ -24,6 +24,7 @@ char* 			   sfs_get_fname(const char* path);
 int 			   sfs_calc_lvl(const char * path);
 int 			   sfs_driver_read(int offset, uint8_t *out_content, int size);
 int 			   sfs_driver_write(int offset, uint8_t *in_content, int size);
+struct sfs_dentry* new_dentry(const char * fname, SFS_FILE_TYPE ftype);
 
 
 int 			   sfs_mount(struct custom_options options);
@@ -39,6 +40,21 @@ struct sfs_dentry* sfs_get_dentry(struct sfs_inode * inode, int dir);
 
 struct sfs_dentry* sfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 /******************************************************************************
+* SECTION: sfs_bitmap.c
+*******************************************************************************/
+int 			   sfs_bitmap_find_zero(const uint8_t *map, int nbits, int hint);
+void 			   sfs_bitmap_set(uint8_t *map, int idx);
+void 			   sfs_bitmap_clear(uint8_t *map, int idx);
+boolean 		   sfs_bitmap_test(const uint8_t *map, int idx);
+/******************************************************************************
+* SECTION: sfs_slab.c
+*******************************************************************************/
+void 			   sfs_slab_init(struct sfs_slab * slab, const char * name, int obj_sz);
+void* 			   sfs_slab_alloc(struct sfs_slab * slab);
+void* 			   sfs_slab_zalloc(struct sfs_slab * slab);
+void 			   sfs_slab_free(struct sfs_slab * slab, void * obj);
+void 			   sfs_slab_destroy(struct sfs_slab * slab);
+/******************************************************************************
 * SECTION: sfs.c
 *******************************************************************************/
 void* 			   sfs_init(struct fuse_conn_info *);
@@ -47,6 +47,9 @@ typedef enum sfs_file_type {
 
 #define SFS_FLAG_BUF_DIRTY      0x1
 #define SFS_FLAG_BUF_OCCUPY     0x2
+
+#define SFS_SLAB_CHUNK_SZ       (64 * 1024)           /* slab每次向系统申请的大小 */
+#define SFS_SLAB_ALIGN          16
 /******************************************************************************
 * SECTION: Macro Function
 *******************************************************************************/
@@ -64,6 +67,10 @@ typedef enum sfs_file_type {
                                         SFS_INODE_PER_FILE + SFS_DATA_PER_FILE)))
 #define SFS_DATA_OFS(ino)               (SFS_INO_OFS(ino) + SFS_BLKS_SZ(SFS_INODE_PER_FILE))
 
+#define SFS_SLAB_DENTRY()               (&sfs_super.dentry_slab)
+#define SFS_SLAB_INODE()                (&sfs_super.inode_slab)
+#define SFS_SLAB_DATA()                 (&sfs_super.data_slab)
+
 #define SFS_IS_DIR(pinode)              (pinode->dentry->ftype == SFS_DIR)
 #define SFS_IS_REG(pinode)              (pinode->dentry->ftype == SFS_REG_FILE)
 #define SFS_IS_SYM_LINK(pinode)         (pinode->dentry->ftype == SFS_SYM_LINK)
@@ -74,6 +81,24 @@ struct sfs_dentry;
 struct sfs_inode;
 struct sfs_super;
 
+struct sfs_slab_chunk
+{
+    struct sfs_slab_chunk* next;                      /* 对象紧跟在头部之后 */
+};
+
+struct sfs_slab
+{
+    const char*        name;
+    int                obj_sz;                        /* 对齐后的对象大小 */
+    int                per_chunk;                     /* 每个chunk切出的对象数 */
+    void*              free_list;                     /* 空闲对象，首字存放下一个空闲对象 */
+    struct sfs_slab_chunk* chunks;
+    int                chunk_cnt;
+    int                in_use;
+    int                peak;
+    long               alloc_cnt;
+};
+
 struct custom_options {
 	const char*        device;
 	boolean            show_help;
@@ -109,6 +134,7 @@ struct sfs_super
     int                sz_usage;
     
     int                max_ino;
+    int                ino_hint;                      /* 下次分配inode时从这一位开始找 */
     uint8_t*           map_inode;
     int                map_inode_blks;
     int                map_inode_offset;
@@ -118,18 +144,12 @@ struct sfs_super
     boolean            is_mounted;
 
     struct sfs_dentry* root_dentry;
+
+    struct sfs_slab    dentry_slab;                   /* struct sfs_dentry */
+    struct sfs_slab    inode_slab;                    /* struct sfs_inode */
+    struct sfs_slab    data_slab;                     /* 文件数据 SFS_DATA_PER_FILE 块 */
 };
 
-static inline struct sfs_dentry* new_dentry(char * fname, SFS_FILE_TYPE ftype) {
-    struct sfs_dentry * dentry = (struct sfs_dentry *)malloc(sizeof(struct sfs_dentry));
-    memset(dentry, 0, sizeof(struct sfs_dentry));
-    SFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;                                            
-}
 /******************************************************************************
 * SECTION: FS Specific Structure - Disk structure
 *******************************************************************************/
@@ -0,0 +1,100 @@
+#include "../include/sfs.h"
+
+/**
+ * slab 分配器
+ *
+ * dentry、inode、文件数据缓冲这类定长对象从按 SFS_SLAB_CHUNK_SZ 批量申请的
+ * chunk 中切分，释放的对象挂回空闲链表供下次复用，不再逐个 malloc/free。
+ * chunk 只在卸载时整体释放。
+ */
+#define SFS_SLAB_HDR_SZ                 SFS_ROUND_UP((int)sizeof(struct sfs_slab_chunk), SFS_SLAB_ALIGN)
+
+/**
+ * @brief 初始化一个对象大小为 obj_sz 的slab
+ */
+void sfs_slab_init(struct sfs_slab *slab, const char *name, int obj_sz) {
+    memset(slab, 0, sizeof(struct sfs_slab));
+    if (obj_sz < (int)sizeof(void *))
+        obj_sz = sizeof(void *);
+    slab->name      = name;
+    slab->obj_sz    = SFS_ROUND_UP(obj_sz, SFS_SLAB_ALIGN);
+    slab->per_chunk = (SFS_SLAB_CHUNK_SZ - SFS_SLAB_HDR_SZ) / slab->obj_sz;
+    if (slab->per_chunk < 1)
+        slab->per_chunk = 1;
+}
+
+/**
+ * @brief 申请一个新chunk并把其中的对象全部挂入空闲链表
+ */
+static int sfs_slab_grow(struct sfs_slab *slab) {
+    struct sfs_slab_chunk *chunk;
+    uint8_t *obj;
+    int i;
+
+    chunk = (struct sfs_slab_chunk *)malloc(SFS_SLAB_HDR_SZ + slab->per_chunk * slab->obj_sz);
+    if (chunk == NULL)
+        return -SFS_ERROR_NOSPACE;
+    chunk->next  = slab->chunks;
+    slab->chunks = chunk;
+    slab->chunk_cnt++;
+
+    obj = (uint8_t *)chunk + SFS_SLAB_HDR_SZ;
+    for (i = slab->per_chunk - 1; i >= 0; i--) {
+        *(void **)(obj + i * slab->obj_sz) = slab->free_list;
+        slab->free_list = obj + i * slab->obj_sz;
+    }
+    return SFS_ERROR_NONE;
+}
+
+/**
+ * @return void* 内容未初始化，失败返回NULL
+ */
+void *sfs_slab_alloc(struct sfs_slab *slab) {
+    void *obj;
+
+    if (slab->free_list == NULL && sfs_slab_grow(slab) != SFS_ERROR_NONE)
+        return NULL;
+    obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    slab->alloc_cnt++;
+    if (++slab->in_use > slab->peak)
+        slab->peak = slab->in_use;
+    return obj;
+}
+
+/**
+ * @return void* 内容清零，失败返回NULL
+ */
+void *sfs_slab_zalloc(struct sfs_slab *slab) {
+    void *obj = sfs_slab_alloc(slab);
+
+    if (obj != NULL)
+        memset(obj, 0, slab->obj_sz);
+    return obj;
+}
+
+void sfs_slab_free(struct sfs_slab *slab, void *obj) {
+    if (obj == NULL)
+        return;
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+}
+
+/**
+ * @brief 释放全部chunk，其中的对象一并失效，卸载时调用
+ */
+void sfs_slab_destroy(struct sfs_slab *slab) {
+    struct sfs_slab_chunk *chunk;
+
+    SFS_DBG("slab %s: obj %d B, in use: %d, peak: %d, allocs: %ld, chunks: %d\n",
+            slab->name, slab->obj_sz, slab->in_use, slab->peak, slab->alloc_cnt,
+            slab->chunk_cnt);
+    while (slab->chunks != NULL) {
+        chunk = slab->chunks;
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    slab->free_list = NULL;
+    slab->chunk_cnt = 0;
+}
@@ -50,15 +50,10 @@ int sfs_driver_read(int offset, uint8_t *out_content, int size) {
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
     uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    struct iovec iov        = {temp_content, size_aligned};
+    if (ddriver_preadv(SFS_DRIVER(), &iov, 1, offset_aligned) != size_aligned) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
     memcpy(out_content, temp_content + bias, size);
     free(temp_content);
@@ -77,23 +72,35 @@ int sfs_driver_write(int offset, uint8_t *in_content, int size) {
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
     uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    sfs_driver_read(offset_aligned, temp_content, size_aligned);
+    struct iovec iov        = {temp_content, size_aligned};
+    if (sfs_driver_read(offset_aligned, temp_content, size_aligned) != SFS_ERROR_NONE) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
+    }
     memcpy(temp_content + bias, in_content, size);
     
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    if (ddriver_pwritev(SFS_DRIVER(), &iov, 1, offset_aligned) != size_aligned) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
 
     free(temp_content);
     return SFS_ERROR_NONE;
 }
+/**
+ * @brief 从slab分配一个dentry
+ * 
+ * @param fname 文件名
+ * @param ftype 文件类型
+ * @return struct sfs_dentry* 
+ */
+struct sfs_dentry* new_dentry(const char * fname, SFS_FILE_TYPE ftype) {
+    struct sfs_dentry * dentry = (struct sfs_dentry *)sfs_slab_zalloc(SFS_SLAB_DENTRY());
+    SFS_ASSIGN_FNAME(dentry, fname);
+    dentry->ftype   = ftype;
+    dentry->ino     = -1;
+    return dentry;
+}
 /**
  * @brief 为一个inode分配dentry，采用头插法
  * 
@@ -153,32 +160,15 @@ int sfs_drop_dentry(struct sfs_inode * inode, struct sfs_dentry * dentry) {
  */
 struct sfs_inode* sfs_alloc_inode(struct sfs_dentry * dentry) {
     struct sfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
-
-    for (byte_cursor = 0; byte_cursor < SFS_BLKS_SZ(sfs_super.map_inode_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((sfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                sfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
-    }
-
-    if (!is_find_free_entry || ino_cursor == sfs_super.max_ino)
+    int ino_cursor;
+                                                      /* 从上次分配的位置往后找 */
+    ino_cursor = sfs_bitmap_find_zero(sfs_super.map_inode, sfs_super.max_ino, sfs_super.ino_hint);
+    if (ino_cursor < 0)
         return -SFS_ERROR_NOSPACE;
+    sfs_bitmap_set(sfs_super.map_inode, ino_cursor);
+    sfs_super.ino_hint = ino_cursor + 1;
 
-    inode = (struct sfs_inode*)malloc(sizeof(struct sfs_inode));
+    inode = (struct sfs_inode*)sfs_slab_alloc(SFS_SLAB_INODE());
     inode->ino  = ino_cursor; 
     inode->size = 0;
                                                       /* dentry指向inode */
@@ -189,9 +179,10 @@ struct sfs_inode* sfs_alloc_inode(struct sfs_dentry * dentry) {
     
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
+    inode->data    = NULL;
     
     if (SFS_IS_REG(inode)) {
-        inode->data = (uint8_t *)malloc(SFS_BLKS_SZ(SFS_DATA_PER_FILE));
+        inode->data = (uint8_t *)sfs_slab_alloc(SFS_SLAB_DATA());
     }
 
     return inode;
@@ -285,15 +276,12 @@ int sfs_drop_inode(struct sfs_inode * inode) {
     struct sfs_dentry*  dentry_to_free;
     struct sfs_inode*   inode_cursor;
 
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find = FALSE;
-
     if (inode == sfs_super.root_dentry->inode) {
         return SFS_ERROR_INVAL;
     }
 
+    sfs_bitmap_clear(sfs_super.map_inode, inode->ino);  /* 调整inodemap */
+
     if (SFS_IS_DIR(inode)) {
         dentry_cursor = inode->dentrys;
                                                       /* 递归向下drop */
@@ -304,28 +292,12 @@ int sfs_drop_inode(struct sfs_inode * inode) {
             sfs_drop_dentry(inode, dentry_cursor);
             dentry_to_free = dentry_cursor;
             dentry_cursor = dentry_cursor->brother;
-            free(dentry_to_free);
+            sfs_slab_free(SFS_SLAB_DENTRY(), dentry_to_free);
         }
     }
     else if (SFS_IS_REG(inode) || SFS_IS_SYM_LINK(inode)) {
-        for (byte_cursor = 0; byte_cursor < SFS_BLKS_SZ(sfs_super.map_inode_blks); 
-            byte_cursor++)                            /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (ino_cursor == inode->ino) {
-                     sfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                     is_find = TRUE;
-                     break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE) {
-                break;
-            }
-        }
-        if (inode->data)
-            free(inode->data);
-        free(inode);
+        sfs_slab_free(SFS_SLAB_DATA(), inode->data);
+        sfs_slab_free(SFS_SLAB_INODE(), inode);
     }
     return SFS_ERROR_NONE;
 }
@@ -337,7 +309,7 @@ int sfs_drop_inode(struct sfs_inode * inode) {
  * @return struct sfs_inode* 
  */
 struct sfs_inode* sfs_read_inode(struct sfs_dentry * dentry, int ino) {
-    struct sfs_inode* inode = (struct sfs_inode*)malloc(sizeof(struct sfs_inode));
+    struct sfs_inode* inode = (struct sfs_inode*)sfs_slab_alloc(SFS_SLAB_INODE());
     struct sfs_inode_d inode_d;
     struct sfs_dentry* sub_dentry;
     struct sfs_dentry_d dentry_d;
@@ -353,6 +325,7 @@ struct sfs_inode* sfs_read_inode(struct sfs_dentry * dentry, int ino) {
     memcpy(inode->target_path, inode_d.target_path, SFS_MAX_FILE_NAME);
     inode->dentry = dentry;
     inode->dentrys = NULL;
+    inode->data    = NULL;
     if (SFS_IS_DIR(inode)) {
         dir_cnt = inode_d.dir_cnt;
         for (i = 0; i < dir_cnt; i++)
@@ -370,7 +343,7 @@ struct sfs_inode* sfs_read_inode(struct sfs_dentry * dentry, int ino) {
         }
     }
     else if (SFS_IS_REG(inode)) {
-        inode->data = (uint8_t *)malloc(SFS_BLKS_SZ(SFS_DATA_PER_FILE));
+        inode->data = (uint8_t *)sfs_slab_alloc(SFS_SLAB_DATA());
         if (sfs_driver_read(SFS_DATA_OFS(ino), (uint8_t *)inode->data, 
                             SFS_BLKS_SZ(SFS_DATA_PER_FILE)) != SFS_ERROR_NONE) {
             SFS_DBG("[%s] io error\n", __func__);
@@ -518,6 +491,9 @@ int sfs_mount(struct custom_options options){
     sfs_super.driver_fd = driver_fd;
     ddriver_ioctl(SFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &sfs_super.sz_disk);
     ddriver_ioctl(SFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &sfs_super.sz_io);
+    sfs_slab_init(SFS_SLAB_DENTRY(), "dentry", sizeof(struct sfs_dentry));
+    sfs_slab_init(SFS_SLAB_INODE(),  "inode",  sizeof(struct sfs_inode));
+    sfs_slab_init(SFS_SLAB_DATA(),   "data",   SFS_BLKS_SZ(SFS_DATA_PER_FILE));
     
     root_dentry = new_dentry("/", SFS_DIR);
 
@@ -536,7 +512,7 @@ int sfs_mount(struct custom_options options){
                          / SFS_IO_SZ();
         
                                                       /* 布局layout */
-        sfs_super.max_ino = (inode_num - super_blks - map_inode_blks); 
+        sfs_super_d.max_ino = (inode_num - super_blks - map_inode_blks); 
         sfs_super_d.map_inode_offset = SFS_SUPER_OFS + SFS_BLKS_SZ(super_blks);
         sfs_super_d.data_offset = sfs_super_d.map_inode_offset + SFS_BLKS_SZ(map_inode_blks);
         sfs_super_d.map_inode_blks  = map_inode_blks;
@@ -545,9 +521,15 @@ int sfs_mount(struct custom_options options){
         is_init = TRUE;
     }
     sfs_super.sz_usage   = sfs_super_d.sz_usage;      /* 建立 in-memory 结构 */
+    sfs_super.max_ino    = sfs_super_d.max_ino;
+    sfs_super.ino_hint   = 0;
     
     sfs_super.map_inode = (uint8_t *)malloc(SFS_BLKS_SZ(sfs_super_d.map_inode_blks));
     sfs_super.map_inode_blks = sfs_super_d.map_inode_blks;
+    if (sfs_super.max_ino <= 0 ||                     /* 旧版本未保存max_ino */
+        sfs_super.max_ino > SFS_BLKS_SZ(sfs_super.map_inode_blks) * UINT8_BITS) {
+        sfs_super.max_ino = SFS_BLKS_SZ(sfs_super.map_inode_blks) * UINT8_BITS;
+    }
     sfs_super.map_inode_offset = sfs_super_d.map_inode_offset;
     sfs_super.data_offset = sfs_super_d.data_offset;
 
@@ -584,6 +566,7 @@ int sfs_umount() {
     sfs_sync_inode(sfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
                                                     
     sfs_super_d.magic_num           = SFS_MAGIC_NUM;
+    sfs_super_d.max_ino             = sfs_super.max_ino;
     sfs_super_d.map_inode_blks      = sfs_super.map_inode_blks;
     sfs_super_d.map_inode_offset    = sfs_super.map_inode_offset;
     sfs_super_d.data_offset         = sfs_super.data_offset;
@@ -600,6 +583,9 @@ int sfs_umount() {
     }
 
     free(sfs_super.map_inode);
+    sfs_slab_destroy(SFS_SLAB_DENTRY());
+    sfs_slab_destroy(SFS_SLAB_INODE());
+    sfs_slab_destroy(SFS_SLAB_DATA());
     ddriver_close(SFS_DRIVER());
 
     return SFS_ERROR_NONE;
@@ -2,6 +2,7 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/uio.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -11,11 +12,137 @@ struct ddriver_state
     int write_cnt;
     int read_cnt;
     int seek_cnt;
+    long long sim_us;                             /* 累计模拟设备时间 (us)，仅用户态驱动 */
+};
+
+#define DDRIVER_LAT_BUCKETS     32                                          /* 延迟直方图格数，第i格为 [2^i, 2^(i+1)) us */
+#define DDRIVER_HEAT_REGIONS    64                                          /* 热度图把磁盘均分的区域数 */
+
+struct ddriver_state_v2
+{
+    unsigned long long read_cnt;
+    unsigned long long write_cnt;
+    unsigned long long seek_cnt;
+    unsigned long long read_bytes;                  /* 累计读出字节数 */
+    unsigned long long write_bytes;                 /* 累计写入字节数 */
+    unsigned long long seek_dist;                   /* 累计寻道距离 (字节) */
+    long long          sim_us;                      /* 累计模拟设备时间 (us) */
+    unsigned long long read_lat_hist[DDRIVER_LAT_BUCKETS];  /* 读延迟直方图，按模拟延迟统计 */
+    unsigned long long write_lat_hist[DDRIVER_LAT_BUCKETS]; /* 写延迟直方图 */
+    long long          region_sz;                   /* 热度图每个区域的大小 (字节) */
+    unsigned long long read_heat[DDRIVER_HEAT_REGIONS];     /* 起始偏移落在各区域的读请求数 */
+    unsigned long long write_heat[DDRIVER_HEAT_REGIONS];    /* 起始偏移落在各区域的写请求数 */
+};
+
+struct ddriver_range
+{
+    long long offset;                               /* 起始偏移，扇区对齐 */
+    long long len;                                  /* 字节数，扇区大小的整数倍 */
 };
 
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_QDEPTH   _IOW(IOC_MAGIC, 4, int)                     /* 设置请求队列深度，仅用户态驱动 */
+#define IOC_REQ_DEVICE_SCHED    _IOW(IOC_MAGIC, 5, int)                     /* 设置异步请求调度策略 DDRIVER_SCHED_*，仅用户态驱动 */
+#define IOC_REQ_DEVICE_SEEK_DIST _IOR(IOC_MAGIC, 6, long)                   /* 请求累计寻道距离 (字节)，仅用户态驱动 */
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 7)                           /* 把写入的数据刷到磁盘镜像文件，仅用户态驱动 */
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 8, long long)               /* 请求设备大小 (64位) */
+#define IOC_REQ_DEVICE_SIM_TIME _IOR(IOC_MAGIC, 9, long long)               /* 请求累计模拟设备时间 (us)，仅用户态驱动 */
+#define IOC_REQ_DEVICE_VCLOCK   _IOW(IOC_MAGIC, 10, int)                    /* 开关虚拟时钟，非0时只累计模拟时间不等待，仅用户态驱动 */
+#define IOC_REQ_DEVICE_STATE_V2 _IOR(IOC_MAGIC, 11, struct ddriver_state_v2) /* 请求64位设备统计，返回 ddriver_state_v2，仅用户态驱动 */
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 12, struct ddriver_range) /* 丢弃一段扇区，之后读出全0，仅用户态驱动 */
+
+/******************************************************************************
+* SECTION: Async request definitions
+*******************************************************************************/
+#define DDRIVER_REQ_READ        0                                           /* 定位向量读 */
+#define DDRIVER_REQ_WRITE       1                                           /* 定位向量写 */
+
+#define DDRIVER_SCHED_FIFO      0                                           /* 按提交顺序派发 */
+#define DDRIVER_SCHED_SCAN      1                                           /* 电梯调度，按偏移单向扫描 */
+#define DDRIVER_SCHED_DEADLINE  2                                           /* 电梯调度，等待过久的请求优先 */
+
+struct ddriver_req
+{
+    int                 fd;
+    int                 op;                         /* DDRIVER_REQ_READ / DDRIVER_REQ_WRITE */
+    const struct iovec *iov;                        /* 同 ddriver_preadv / pwritev，完成前不能释放 */
+    int                 iovcnt;
+    off_t               offset;
+    int                 res;                        /* 完成后为读写的字节数，小于0失败 */
+    void              (*done)(struct ddriver_req *req); /* 非NULL时在驱动线程中回调，不进入完成队列 */
+    void               *private;                    /* 调用者私有 */
+    struct ddriver_req *next;                       /* 驱动内部使用 */
+    long long           stamp;                      /* 驱动内部使用，提交时间 (ms) */
+};
+
+/******************************************************************************
+* SECTION: Disk geometry definitions
+*******************************************************************************/
+#define DDRIVER_TAIL_NONE       0                                           /* 没有长尾 */
+#define DDRIVER_TAIL_EXP        1                                           /* 附加延迟服从均值为 tail_us 的指数分布 */
+#define DDRIVER_TAIL_PARETO     2                                           /* 附加延迟服从下限为 tail_us 的帕累托分布 */
+
+struct ddriver_profile
+{
+    const char *name;
+    int  read_us;                                   /* 随机读的基本延迟 (us) */
+    int  seq_read_us;                               /* 紧接上一次请求的顺序读 (us) */
+    int  write_us;                                  /* 随机写的基本延迟 (us) */
+    int  seq_write_us;                              /* 紧接上一次请求的顺序写 (us) */
+    int  seek_min_us;                               /* 相邻磁道的寻道时间 (us) */
+    int  seek_max_us;                               /* 全行程寻道时间 (us)，0表示没有寻道 */
+    int  rotate_us;                                 /* 旋转一圈的时间 (us)，0表示没有旋转延迟 */
+    int  bandwidth_mb;                              /* 传输带宽 (MB/s)，0表示不计传输时间 */
+    int  parallel;                                  /* 内部并行度，在途请求更多时基本延迟按比例变长 */
+    int  tail_dist;                                 /* DDRIVER_TAIL_* */
+    int  tail_ppm;                                  /* 每百万个请求中出现长尾的个数 */
+    int  tail_us;                                   /* 长尾附加延迟 (us) */
+};
+
+struct ddriver_options
+{
+    long disk_sz;                                   /* 磁盘大小 (字节)，扇区大小的整数倍 */
+    int  sector_sz;                                 /* 扇区大小，即IO大小，不小于512的2的幂 */
+    int  track_num;                                 /* 磁道数，决定寻道和旋转延迟的粒度 */
+    struct ddriver_profile profile;                 /* 设备模型，见 ddriver_find_profile */
+    int  use_mmap;                                  /* 非0时以mmap方式访问磁盘镜像 */
+    int  virtual_clock;                             /* 非0时只累计模拟时间，不真正等待 */
+    const char *trace_path;                         /* 非NULL时把每个请求记录到这个环形trace文件 */
+    long trace_records;                             /* trace文件最多保留的记录数 */
+};
+
+/******************************************************************************
+* SECTION: Trace definitions
+*******************************************************************************/
+#define DDRIVER_TRACE_MAGIC     "DDTRACE1"                                  /* 8字节，不含结尾的'\0' */
+#define DDRIVER_TRACE_VERSION   1
+#define DDRIVER_TRACE_SEEK      2                                           /* ddriver_seek，op 的其他取值同 DDRIVER_REQ_* */
+#define DDRIVER_TRACE_DISCARD   3                                           /* IOC_REQ_DEVICE_DISCARD */
+#define DDRIVER_TRACE_ASYNC     0x1                                         /* 由 ddriver_submit 提交 */
+
+struct ddriver_trace_hdr
+{
+    char               magic[8];
+    unsigned int       version;
+    unsigned int       rec_sz;                      /* sizeof(struct ddriver_trace_rec) */
+    unsigned long long capacity;                    /* 环中的记录数 */
+    unsigned long long next;                        /* 已写入的记录总数，第i条记录在 i % capacity */
+    long long          disk_sz;                     /* 记录时的磁盘大小 */
+    int                sector_sz;                   /* 记录时的扇区大小 */
+    int                reserved;
+};
+
+struct ddriver_trace_rec
+{
+    unsigned long long ts_us;                       /* 距trace开始的时间 (us)，请求发起时记录 */
+    long long          offset;
+    unsigned int       len;                         /* 字节数，seek为0 */
+    unsigned char      op;                          /* DDRIVER_REQ_* / DDRIVER_TRACE_SEEK / DDRIVER_TRACE_DISCARD */
+    unsigned char      flags;                       /* DDRIVER_TRACE_ASYNC */
+    unsigned short     reserved;
+};
 
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "../include/ddriver.h"
 #include <linux/fs.h>
+#include <string.h>
 
 int main(int argc, char const *argv[])
 {
@@ -42,6 +43,196 @@ int main(int argc, char const *argv[])
     printf("write_cnt: %d\n", state.write_cnt);
     printf("seek_cnt: %d\n", state.seek_cnt);
 
+    /* Cycle 5: readv/writev test - 2 sectors in one request */
+    char vbuffer[1024];
+    char vrbuffer[1024];
+    struct iovec wiov = {vbuffer, 1024};
+    struct iovec riov[2] = {{vrbuffer, 512}, {vrbuffer + 512, 512}};
+    memset(vbuffer, 'b', 1024);
+    ddriver_seek(fd, 0, SEEK_SET);
+    ddriver_writev(fd, &wiov, 1);
+    ddriver_seek(fd, 0, SEEK_SET);
+    ddriver_readv(fd, riov, 2);
+    if (memcmp(vbuffer, vrbuffer, 1024) != 0) {
+        printf("readv/writev mismatch\n");
+        return -1;
+    }
+
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &state);
+    printf("read_cnt: %d\n", state.read_cnt);
+    printf("write_cnt: %d\n", state.write_cnt);
+    printf("seek_cnt: %d\n", state.seek_cnt);
+
+    /* Cycle 6: pread/pwrite test - positional IO, head position untouched */
+    char pbuffer[512];
+    char prbuffer[512];
+    struct iovec piov = {vrbuffer, 1024};
+    int depth = 4;
+    memset(pbuffer, 'c', 512);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_QDEPTH, &depth);
+    ddriver_pwrite(fd, pbuffer, 512, 1024);
+    ddriver_pread(fd, prbuffer, 512, 1024);
+    if (memcmp(pbuffer, prbuffer, 512) != 0) {
+        printf("pread/pwrite mismatch\n");
+        return -1;
+    }
+    ddriver_preadv(fd, &piov, 1, 0);
+    if (memcmp(vbuffer, vrbuffer, 1024) != 0) {
+        printf("preadv mismatch\n");
+        return -1;
+    }
+
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &state);
+    printf("read_cnt: %d\n", state.read_cnt);
+    printf("write_cnt: %d\n", state.write_cnt);
+    printf("seek_cnt: %d\n", state.seek_cnt);
+
+    /* Cycle 7: submit/poll test - 2 async requests in flight, elevator order */
+    struct ddriver_req areqs[2];
+    struct ddriver_req *adone[2];
+    struct iovec aiov[2] = {{pbuffer, 512}, {prbuffer, 512}};
+    int reaped = 0;
+    int sched = DDRIVER_SCHED_SCAN;
+    long seek_dist;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SCHED, &sched);
+    memset(areqs, 0, sizeof(areqs));
+    memset(prbuffer, 0, 512);
+    areqs[0].op = DDRIVER_REQ_WRITE;
+    areqs[0].iov = &aiov[0];
+    areqs[0].iovcnt = 1;
+    areqs[0].offset = 2048;
+    areqs[1].op = DDRIVER_REQ_READ;
+    areqs[1].iov = &aiov[1];
+    areqs[1].iovcnt = 1;
+    areqs[1].offset = 1024;
+    ddriver_submit(fd, &areqs[0]);
+    ddriver_submit(fd, &areqs[1]);
+    while (reaped < 2) {
+        reaped += ddriver_poll(fd, adone + reaped, 1, 2 - reaped);
+    }
+    if (areqs[0].res != 512 || areqs[1].res != 512 || memcmp(pbuffer, prbuffer, 512) != 0) {
+        printf("submit/poll mismatch\n");
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SEEK_DIST, &seek_dist);
+    printf("seek_dist: %ld\n", seek_dist);
+
+    /* Cycle 8: ioctl test - 64 bit size agrees with int size on a small disk */
+    long long size64;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE64, &size64);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE, &size);
+    printf("size64: %lld\n", size64);
+    if (size64 != size) {
+        printf("size mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 9: virtual clock test - latency accounted without sleeping */
+    long long sim_before, sim_after;
+    int vclock = 1;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_VCLOCK, &vclock);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIM_TIME, &sim_before);
+    for (int i = 0; i < 100; i++) {
+        ddriver_pwrite(fd, pbuffer, 512, 512 * (i % 8));
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &state);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIM_TIME, &sim_after);
+    printf("sim_us: %lld\n", sim_after);
+    if (sim_after <= sim_before || state.sim_us != sim_after) {
+        printf("virtual clock mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 10: profile test - built-in device models */
+    struct ddriver_profile prof;
+    if (ddriver_find_profile("nvme", &prof) != 0 || prof.seq_read_us > prof.read_us ||
+        ddriver_find_profile("floppy", &prof) == 0) {
+        printf("profile lookup mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 11: ioctl test - v2 state agrees with v1, histograms and heatmap add up */
+    struct ddriver_state_v2 state2;
+    unsigned long long hist_sum = 0, heat_sum = 0;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &state);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE_V2, &state2);
+    for (int i = 0; i < DDRIVER_LAT_BUCKETS; i++) {
+        hist_sum += state2.write_lat_hist[i];
+    }
+    for (int i = 0; i < DDRIVER_HEAT_REGIONS; i++) {
+        heat_sum += state2.write_heat[i];
+    }
+    printf("write_bytes: %llu, region_sz: %lld, region 0 writes: %llu\n",
+           state2.write_bytes, state2.region_sz, state2.write_heat[0]);
+    if (state2.write_cnt != (unsigned long long)state.write_cnt || hist_sum != state2.write_cnt ||
+        heat_sum != state2.write_cnt || state2.write_bytes < 512 * state2.write_cnt) {
+        printf("state v2 mismatch\n");
+        return -1;
+    }
+
+    ddriver_close(fd);
+
+    /* Cycle 12: trace test - reopen with a small ring, 3 requests wrap it */
+    struct ddriver_options opts;
+    struct ddriver_trace_hdr hdr;
+    struct ddriver_trace_rec rec;
+    FILE *trace;
+    ddriver_default_options(&opts);
+    opts.virtual_clock = 1;
+    opts.trace_path = "/tmp/ddriver_test_trace";
+    opts.trace_records = 2;
+    fd = ddriver_open_ex("/home/students/200111223/ddriver", &opts);
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_pwrite(fd, buffer, 512, 0);
+    ddriver_pwrite(fd, buffer, 512, 1024);
+    ddriver_pread(fd, rbuffer, 512, 2048);
+    ddriver_close(fd);
+    trace = fopen(opts.trace_path, "rb");
+    if (trace == NULL || fread(&hdr, sizeof(hdr), 1, trace) != 1) {
+        printf("trace missing\n");
+        return -1;
+    }
+    fseek(trace, sizeof(hdr) + (hdr.next - 1) % hdr.capacity * sizeof(rec), SEEK_SET);
+    if (fread(&rec, sizeof(rec), 1, trace) != 1 || hdr.next != 3 || hdr.capacity != 2 ||
+        rec.op != DDRIVER_REQ_READ || rec.offset != 2048 || rec.len != 512) {
+        printf("trace mismatch\n");
+        return -1;
+    }
+    fclose(trace);
+    remove(opts.trace_path);
+
+    /* Cycle 13: discard test - discarded sectors read back as zeros */
+    struct ddriver_range range = {1024, 1024};
+    char zero[512] = {0};
+    opts.trace_path = NULL;
+    fd = ddriver_open_ex("/home/students/200111223/ddriver", &opts);
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_pwrite(fd, buffer, 512, 1536);
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &range) != 0) {
+        printf("discard failed\n");
+        return -1;
+    }
+    range.offset = 100;
+    if (ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &range) == 0) {
+        printf("unaligned discard accepted\n");
+        return -1;
+    }
+    ddriver_pread(fd, rbuffer, 512, 1536);
+    if (memcmp(rbuffer, zero, 512) != 0) {
+        printf("discarded sector not zero\n");
+        return -1;
+    }
+    /* out-of-range positional IO fails without the mmap backend too */
+    long long disk_sz;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE64, &disk_sz);
+    if (ddriver_pwrite(fd, buffer, 512, disk_sz) >= 0 || ddriver_pread(fd, rbuffer, 512, disk_sz) >= 0) {
+        printf("out-of-range io accepted\n");
+        return -1;
+    }
     ddriver_close(fd);
 
     printf("Test Pass :)\n");